@@ -0,0 +1,88 @@
+#include "arena.h"
+#include "buffer_pool.h"
+#include <string.h>
+#include <stdint.h>
+
+// 块头之后的第一个位置，保证最大对齐
+#define ARENA_HEADER_SIZE ((sizeof(block) + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1))
+
+arena::arena() : m_cur(NULL), m_end(NULL), m_blocks(NULL)
+{
+}
+
+arena::~arena()
+{
+    reset();
+}
+
+void *arena::alloc(size_t size, size_t align)
+{
+    char *p = (char *)(((uintptr_t)m_cur + align - 1) & ~(uintptr_t)(align - 1));
+    if (m_cur != NULL && p + size <= m_end)
+    {
+        m_cur = p + size;
+        return p;
+    }
+
+    block *b;
+    if (size + align > BUFFER_POOL_BUFFER_SIZE - ARENA_HEADER_SIZE)
+    {
+        // 大块单独申请，不作为当前块，后面的小分配继续用原来的块
+        b = (block *)new char[ARENA_HEADER_SIZE + size + align];
+        b->m_large = true;
+        b->m_next = m_blocks;
+        m_blocks = b;
+        return (void *)(((uintptr_t)b + ARENA_HEADER_SIZE + align - 1) & ~(uintptr_t)(align - 1));
+    }
+    b = (block *)buffer_pool::alloc();
+    b->m_large = false;
+    b->m_next = m_blocks;
+    m_blocks = b;
+    m_cur = (char *)b + ARENA_HEADER_SIZE;
+    m_end = (char *)b + BUFFER_POOL_BUFFER_SIZE;
+    p = (char *)(((uintptr_t)m_cur + align - 1) & ~(uintptr_t)(align - 1));
+    m_cur = p + size;
+    return p;
+}
+
+char *arena::grow(char *ptr, size_t old_size, size_t new_size)
+{
+    if (ptr != NULL && ptr + old_size == m_cur && ptr + new_size <= m_end)
+    {
+        m_cur = ptr + new_size;
+        return ptr;
+    }
+    char *p = (char *)alloc(new_size, 1);
+    if (ptr != NULL)
+    {
+        memcpy(p, ptr, old_size);
+    }
+    return p;
+}
+
+char *arena::dup(std::string_view str)
+{
+    char *p = (char *)alloc(str.size() + 1, 1);
+    memcpy(p, str.data(), str.size());
+    p[str.size()] = '\0';
+    return p;
+}
+
+void arena::reset()
+{
+    while (m_blocks != NULL)
+    {
+        block *b = m_blocks;
+        m_blocks = b->m_next;
+        if (b->m_large)
+        {
+            delete[] (char *)b;
+        }
+        else
+        {
+            buffer_pool::free((char *)b);
+        }
+    }
+    m_cur = NULL;
+    m_end = NULL;
+}
@@ -0,0 +1,43 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <string_view>
+
+/**
+ * @brief 请求级的bump-pointer分配器
+ * 每个连接一个，请求处理过程中的临时数据(响应头、规范化的路径等)都从这里分配，
+ * 不单独释放，下一个请求开始时reset一次全部归还。
+ * 内存块从缓冲区池借用，空闲连接不占内存；超过一块大小的分配单独申请。
+ */
+class arena
+{
+public:
+    arena();
+    ~arena();
+    // 分配size字节，按align对齐
+    void *alloc(size_t size, size_t align = alignof(max_align_t));
+    // 把ptr处old_size字节的分配扩大到new_size，ptr是最后一次分配时原地扩大，否则复制
+    char *grow(char *ptr, size_t old_size, size_t new_size);
+    // 复制一个字符串，结尾加\0
+    char *dup(std::string_view str);
+    // 归还所有内存块
+    void reset();
+
+private:
+    struct block
+    {
+        block *m_next;
+        // 单独申请的大块，归还时delete，否则还给缓冲区池
+        bool m_large;
+    };
+
+    char *m_cur;
+    char *m_end;
+    block *m_blocks;
+
+    arena(const arena &);
+    arena &operator=(const arena &);
+};
+
+#endif // !ARENA_H
@@ -0,0 +1,105 @@
+#include "buffer_pool.h"
+#include "locker.h"
+#include <atomic>
+
+/// @brief 空闲缓冲区，复用缓冲区开头的空间作为链表指针
+struct free_buffer
+{
+    free_buffer *m_next;
+};
+
+// 全局空闲链表
+static locker global_locker;
+static free_buffer *global_head = NULL;
+static std::atomic<long> total_num(0);
+
+/**
+ * @brief 线程自己的空闲链表，线程退出时把缓冲区还给全局链表
+ */
+struct thread_cache
+{
+    free_buffer *m_head;
+    int m_count;
+
+    thread_cache() : m_head(NULL), m_count(0) {}
+    ~thread_cache()
+    {
+        while (m_count > 0)
+        {
+            flush(m_count);
+        }
+    }
+    // 把count个缓冲区还给全局链表
+    void flush(int count)
+    {
+        free_buffer *head = m_head;
+        free_buffer *tail = head;
+        for (int i = 1; i < count; i++)
+        {
+            tail = tail->m_next;
+        }
+        m_head = tail->m_next;
+        m_count -= count;
+        global_locker.lock();
+        tail->m_next = global_head;
+        global_head = head;
+        global_locker.unlock();
+    }
+    // 从全局链表取最多count个缓冲区
+    void refill(int count)
+    {
+        global_locker.lock();
+        while (count > 0 && global_head != NULL)
+        {
+            free_buffer *buf = global_head;
+            global_head = buf->m_next;
+            buf->m_next = m_head;
+            m_head = buf;
+            m_count++;
+            count--;
+        }
+        global_locker.unlock();
+    }
+};
+
+static thread_local thread_cache cache;
+
+char *buffer_pool::alloc()
+{
+    if (cache.m_head == NULL)
+    {
+        cache.refill(BUFFER_POOL_BATCH);
+    }
+    if (cache.m_head == NULL)
+    {
+        // 池中没有空闲的，新分配
+        total_num++;
+        return new char[BUFFER_POOL_BUFFER_SIZE];
+    }
+    free_buffer *buf = cache.m_head;
+    cache.m_head = buf->m_next;
+    cache.m_count--;
+    return (char *)buf;
+}
+
+void buffer_pool::free(char *buf)
+{
+    if (buf == NULL)
+    {
+        return;
+    }
+    free_buffer *node = (free_buffer *)buf;
+    node->m_next = cache.m_head;
+    cache.m_head = node;
+    cache.m_count++;
+    if (cache.m_count > BUFFER_POOL_CACHE_NUM)
+    {
+        // 留一部分，避免在边界上来回转移
+        cache.flush(BUFFER_POOL_BATCH);
+    }
+}
+
+long buffer_pool::total()
+{
+    return total_num;
+}
@@ -0,0 +1,31 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+
+// 缓冲区大小
+#define BUFFER_POOL_BUFFER_SIZE 2048
+// 每个线程最多缓存的空闲缓冲区数
+#define BUFFER_POOL_CACHE_NUM 64
+// 线程缓存和全局链表之间一次转移的缓冲区数
+#define BUFFER_POOL_BATCH 32
+
+/**
+ * @brief 全局共享的定长IO缓冲区池
+ * 连接只在有数据收发时借用缓冲区，空闲的保持连接不占缓冲区。
+ * 每个线程有自己的空闲链表，分配和归还一般不加锁；线程缓存满了或者空了，
+ * 才成批地和全局链表交换。空闲缓冲区的前8字节用来串成链表，缓冲区不清零。
+ */
+class buffer_pool
+{
+public:
+    // 借一个缓冲区
+    static char *alloc();
+    // 归还缓冲区，可以在和alloc不同的线程中调用
+    static void free(char *buf);
+    static size_t buffer_size() { return BUFFER_POOL_BUFFER_SIZE; }
+    // 已经分配的缓冲区总数
+    static long total();
+};
+
+#endif // !BUFFER_POOL_H
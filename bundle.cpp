@@ -0,0 +1,121 @@
+#include "bundle.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bundle::bundle() : m_addr(NULL), m_size(0), m_header(NULL), m_slots(NULL), m_files(NULL)
+{
+}
+
+bundle::~bundle()
+{
+    if (m_addr != NULL)
+    {
+        munmap(m_addr, m_size);
+    }
+}
+
+/**
+ * @brief 映射打包文件。只检查文件头和两张表的范围，和文件数无关，
+ * 每个文件的数据在查找到时再检查
+ *
+ * @param path
+ * @return false 打不开、格式或版本不对、被截断
+ */
+bool bundle::open(const char *path)
+{
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || (size_t)st.st_size < sizeof(bundle_header))
+    {
+        close(fd);
+        return false;
+    }
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        return false;
+    }
+    m_addr = (char *)addr;
+    m_size = st.st_size;
+    m_header = (const bundle_header *)m_addr;
+    const bundle_header &h = *m_header;
+    if (memcmp(h.m_magic, BUNDLE_MAGIC, sizeof(h.m_magic)) != 0 || h.m_version != BUNDLE_VERSION || h.m_size != m_size ||
+        h.m_hash_size == 0 || (h.m_hash_size & (h.m_hash_size - 1)) != 0 || h.m_file_num >= h.m_hash_size ||
+        h.m_slots_offset % alignof(uint32_t) != 0 || h.m_files_offset % alignof(bundle_file) != 0 ||
+        h.m_slots_offset > m_size || (m_size - h.m_slots_offset) / sizeof(uint32_t) < h.m_hash_size ||
+        h.m_files_offset > m_size || (m_size - h.m_files_offset) / sizeof(bundle_file) < h.m_file_num)
+    {
+        munmap(m_addr, m_size);
+        m_addr = NULL;
+        m_header = NULL;
+        return false;
+    }
+    m_slots = (const uint32_t *)(m_addr + h.m_slots_offset);
+    m_files = (const bundle_file *)(m_addr + h.m_files_offset);
+    return true;
+}
+
+/**
+ * @brief 开放寻址查找，遇到空槽位说明不存在
+ *
+ * @param path 相对根目录的路径，以/开头
+ * @return const bundle_file*
+ */
+const bundle_file *bundle::find(std::string_view path) const
+{
+    uint32_t mask = m_header->m_hash_size - 1;
+    uint32_t slot = header_hash(path, m_header->m_hash_seed) & mask;
+    for (uint32_t i = 0; i < m_header->m_hash_size; i++)
+    {
+        uint32_t index = m_slots[slot];
+        if (index == 0 || index > m_header->m_file_num)
+        {
+            return NULL;
+        }
+        const bundle_file *file = &m_files[index - 1];
+        if (file->m_path_len == path.size() && file->m_path_offset <= m_size &&
+            m_size - file->m_path_offset >= file->m_path_len &&
+            memcmp(m_addr + file->m_path_offset, path.data(), path.size()) == 0)
+        {
+            return valid(file) ? file : NULL;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+/**
+ * @brief 检查文件的每种表示都在打包文件范围内，损坏的文件当作不存在
+ *
+ * @param file
+ */
+bool bundle::valid(const bundle_file *file) const
+{
+    if (file->m_reprs[ENCODING_IDENTITY].m_offset == 0 ||
+        memchr(file->m_last_modified, '\0', sizeof(file->m_last_modified)) == NULL)
+    {
+        return false;
+    }
+    for (int i = 0; i <= ENCODING_NUM; i++)
+    {
+        const bundle_repr &repr = file->m_reprs[i];
+        if (repr.m_offset == 0)
+        {
+            continue;
+        }
+        if (repr.m_etag_len > BUNDLE_ETAG_SIZE || repr.m_offset > m_size ||
+            m_size - repr.m_offset < repr.m_head_len || m_size - repr.m_offset - repr.m_head_len < repr.m_body_len)
+        {
+            return false;
+        }
+    }
+    return true;
+}
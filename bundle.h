@@ -0,0 +1,78 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include "http_conn.h"
+#include "http_response.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string_view>
+
+// 打包文件开头的标识
+#define BUNDLE_MAGIC "WSBUNDL1"
+#define BUNDLE_VERSION 1
+// 打包文件中ETag的最大长度，包括压缩编码的后缀
+#define BUNDLE_ETAG_SIZE 48
+
+/// @brief 打包文件头。后面依次是哈希表、文件表、路径和响应数据，偏移都从文件开头算
+struct bundle_header
+{
+    char m_magic[8];
+    uint32_t m_version;
+    uint32_t m_file_num;
+    uint32_t m_hash_size;    // 哈希表的槽位数(2的幂)，开放寻址
+    uint32_t m_hash_seed;    // header_hash的种子
+    uint64_t m_slots_offset; // uint32_t[m_hash_size]，槽位中是文件表的下标加一，0表示空
+    uint64_t m_files_offset; // bundle_file[m_file_num]
+    uint64_t m_size;         // 整个打包文件的大小，用来发现截断
+};
+
+/// @brief 文件的一种表示(原文件或者压缩后的)。响应头和内容连续存放，和文件缓存中的响应一样直接发送
+struct bundle_repr
+{
+    uint64_t m_offset;   // 响应头的偏移，内容紧跟在后面，没有这种表示时为0
+    uint64_t m_body_len;
+    uint32_t m_head_len; // 状态行到Vary，不含Date、Connection和空行
+    uint32_t m_etag_len;
+    char m_etag[BUNDLE_ETAG_SIZE];
+};
+
+/// @brief 打包的一个文件
+struct bundle_file
+{
+    uint64_t m_path_offset; // 相对根目录的路径，以/开头，和文件缓存的键一样
+    uint32_t m_path_len;
+    uint32_t m_compressible; // 响应随Accept-Encoding不同
+    int64_t m_mtime;
+    char m_last_modified[HTTP_DATE_SIZE];
+    bundle_repr m_reprs[ENCODING_NUM + 1]; // 下标是CONTENT_ENCODING，原文件在最后
+};
+
+/**
+ * @brief 只读映射的打包文件(由bundle_pack生成)。启动时映射一次，查找是一次哈希探测，
+ * 不需要任何系统调用，多个进程映射同一个文件时共享页缓存。
+ * 部署新版本时用rename替换文件，不能原地改写，否则映射中的页会变化或者被截断
+ */
+class bundle
+{
+public:
+    bundle();
+    ~bundle();
+    // 映射并检查文件头，失败时返回false
+    bool open(const char *path);
+    // 按相对根目录的路径查找，没有或者数据越界时返回NULL
+    const bundle_file *find(std::string_view path) const;
+    const char *data(uint64_t offset) const { return m_addr + offset; }
+    uint32_t size() const { return m_header->m_file_num; }
+
+private:
+    char *m_addr;
+    size_t m_size;
+    const bundle_header *m_header;
+    const uint32_t *m_slots;
+    const bundle_file *m_files;
+
+private:
+    bool valid(const bundle_file *file) const;
+};
+
+#endif // !BUNDLE_H
@@ -0,0 +1,243 @@
+// 把网站根目录打包成一个文件，服务器用-b映射后直接发送，不再访问文件系统
+// 用法: ./bundle_pack <根目录> <打包文件> [-n]
+#include "bundle.h"
+#include "compress.h"
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+/// @brief 要打包的文件
+struct pack_file
+{
+    std::string m_path; // 相对根目录的路径，以/开头
+    struct stat m_stat;
+};
+
+static size_t root_len;
+static std::vector<pack_file> files;
+
+static int collect(const char *path, const struct stat *st, int type, struct FTW *)
+{
+    // 符号链接、设备文件等不打包，和服务器一样只返回其他人可读的普通文件
+    if (type == FTW_F && S_ISREG(st->st_mode) && (st->st_mode & S_IROTH))
+    {
+        files.push_back({std::string(path + root_len), *st});
+    }
+    return 0;
+}
+
+static bool read_file(const std::string &path, std::string &data)
+{
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (fp == NULL)
+    {
+        return false;
+    }
+    char buf[65536];
+    size_t n;
+    data.clear();
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    {
+        data.append(buf, n);
+    }
+    bool ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+/// @brief FNV-1a 64位，打包的文件不会变，ETag由内容决定，重新打包后没变的文件仍然命中客户端缓存
+static uint64_t fnv1a64(const std::string &data)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned char c : data)
+    {
+        h = (h ^ c) * 1099511628211ull;
+    }
+    return h;
+}
+
+/**
+ * @brief 生成和http_conn::append_file_head一样的响应头，Date和Connection由服务器在发送时插入
+ *
+ * @param path
+ * @param encoding
+ * @param body_len
+ * @param etag
+ * @param last_modified
+ * @param vary
+ * @return std::string
+ */
+static std::string make_head(const std::string &path, int encoding, size_t body_len, const std::string &etag,
+                             const char *last_modified, bool vary)
+{
+    std::string head(status_line(HTTP_CODE::FILE_REQUEST));
+    head += content_type_line(path);
+    if (encoding != ENCODING_IDENTITY)
+    {
+        head += ENCODINGS[encoding].m_line;
+    }
+    head += "Content-Length: " + std::to_string(body_len) + "\r\n";
+    head += "ETag: " + etag + "\r\n";
+    head += std::string("Last-Modified: ") + last_modified + "\r\n";
+    if (vary)
+    {
+        head += "Vary: Accept-Encoding\r\n";
+    }
+    return head;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        printf("用法: %s <根目录> <打包文件> [-n]\n", argv[0]);
+        printf("  -n    不生成压缩版本\n");
+        return -1;
+    }
+    std::string root = argv[1];
+    while (root.size() > 1 && root.back() == '/')
+    {
+        root.pop_back();
+    }
+    bool compress = !(argc > 3 && strcmp(argv[3], "-n") == 0);
+    root_len = root == "/" ? 0 : root.size();
+    if (nftw(root.c_str(), collect, 64, FTW_PHYS) == -1)
+    {
+        perror("nftw");
+        return -1;
+    }
+    std::sort(files.begin(), files.end(), [](const pack_file &a, const pack_file &b) { return a.m_path < b.m_path; });
+    std::unordered_set<std::string> paths;
+    for (const pack_file &f : files)
+    {
+        paths.insert(f.m_path);
+    }
+
+    // 装载因子不超过1/2
+    uint32_t hash_size = 16;
+    while (hash_size < files.size() * 2)
+    {
+        hash_size *= 2;
+    }
+    bundle_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.m_magic, BUNDLE_MAGIC, sizeof(header.m_magic));
+    header.m_version = BUNDLE_VERSION;
+    header.m_file_num = files.size();
+    header.m_hash_size = hash_size;
+    header.m_hash_seed = HEADER_HASH_SEED;
+    header.m_slots_offset = sizeof(bundle_header);
+    header.m_files_offset = header.m_slots_offset + hash_size * sizeof(uint32_t);
+    header.m_files_offset = (header.m_files_offset + alignof(bundle_file) - 1) / alignof(bundle_file) * alignof(bundle_file);
+    std::vector<uint32_t> slots(hash_size, 0);
+    std::vector<bundle_file> entries(files.size());
+    memset(entries.data(), 0, entries.size() * sizeof(bundle_file));
+
+    // 先写到临时文件再改名，正在映射旧文件的服务器不受影响
+    std::string output = argv[2];
+    std::string tmp = output + ".tmp";
+    FILE *out = fopen(tmp.c_str(), "wb");
+    if (out == NULL)
+    {
+        perror(tmp.c_str());
+        return -1;
+    }
+    uint64_t offset = header.m_files_offset + files.size() * sizeof(bundle_file);
+    fseek(out, offset, SEEK_SET);
+    size_t raw_bytes = 0;
+    size_t variant_num = 0;
+    std::string data;
+    std::string variant;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        const pack_file &f = files[i];
+        bundle_file &entry = entries[i];
+        if (!read_file(root + f.m_path, data))
+        {
+            printf("%s读取失败\n", f.m_path.c_str());
+            fclose(out);
+            unlink(tmp.c_str());
+            return -1;
+        }
+        raw_bytes += data.size();
+        entry.m_path_offset = offset;
+        entry.m_path_len = f.m_path.size();
+        fwrite(f.m_path.data(), 1, f.m_path.size(), out);
+        offset += f.m_path.size();
+        entry.m_mtime = f.m_stat.st_mtime;
+        format_http_date(f.m_stat.st_mtime, entry.m_last_modified);
+        entry.m_compressible = find_mime_type(f.m_path).m_compressible;
+
+        char etag[BUNDLE_ETAG_SIZE];
+        snprintf(etag, sizeof(etag), "\"%zx-%lx\"", data.size(), (unsigned long)fnv1a64(data));
+        std::string identity_etag = etag;
+        for (int e = 0; e <= ENCODING_NUM; e++)
+        {
+            const std::string *body = &data;
+            std::string repr_etag = identity_etag;
+            if (e != ENCODING_IDENTITY)
+            {
+                if (!compress || !entry.m_compressible || data.size() < COMPRESS_MIN_FILE_SIZE)
+                {
+                    continue;
+                }
+                // 有预压缩的兄弟文件时用它，否则现在压缩
+                std::string sibling = f.m_path + std::string(ENCODINGS[e].m_suffix);
+                if (paths.count(sibling) == 0 || !read_file(root + sibling, variant))
+                {
+                    char *compressed;
+                    size_t len;
+                    if (!compress_buffer(data.data(), data.size(), (CONTENT_ENCODING)e, compressed, len))
+                    {
+                        continue;
+                    }
+                    variant.assign(compressed, len);
+                    delete[] compressed;
+                }
+                body = &variant;
+                repr_etag.insert(repr_etag.size() - 1, "-" + std::string(ENCODINGS[e].m_name));
+                variant_num++;
+            }
+            std::string head = make_head(f.m_path, e, body->size(), repr_etag, entry.m_last_modified, entry.m_compressible);
+            bundle_repr &repr = entry.m_reprs[e];
+            repr.m_offset = offset;
+            repr.m_head_len = head.size();
+            repr.m_body_len = body->size();
+            repr.m_etag_len = repr_etag.size();
+            memcpy(repr.m_etag, repr_etag.data(), repr_etag.size());
+            fwrite(head.data(), 1, head.size(), out);
+            fwrite(body->data(), 1, body->size(), out);
+            offset += head.size() + body->size();
+        }
+
+        uint32_t slot = header_hash(f.m_path, header.m_hash_seed) & (hash_size - 1);
+        while (slots[slot] != 0)
+        {
+            slot = (slot + 1) & (hash_size - 1);
+        }
+        slots[slot] = i + 1;
+    }
+
+    header.m_size = offset;
+    fseek(out, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(slots.data(), sizeof(uint32_t), slots.size(), out);
+    fseek(out, header.m_files_offset, SEEK_SET);
+    fwrite(entries.data(), sizeof(bundle_file), entries.size(), out);
+    if (ferror(out) || fclose(out) != 0 || rename(tmp.c_str(), output.c_str()) == -1)
+    {
+        perror(output.c_str());
+        unlink(tmp.c_str());
+        return -1;
+    }
+    printf("打包%zu个文件(%zu字节)，%zu个压缩版本，共%lu字节\n", files.size(), raw_bytes, variant_num,
+           (unsigned long)header.m_size);
+    return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef CHUNK_SOURCE_H
+#define CHUNK_SOURCE_H
+
+/**
+ * @brief 流式响应的数据来源
+ * 连接每发送完一块就调用read取下一块，取到的数据马上按chunked编码发出去，
+ * 第一块不用等整个响应生成完，响应再大也只占一个缓冲区。
+ * 由连接在响应结束或连接关闭时delete。
+ */
+class chunk_source
+{
+public:
+    virtual ~chunk_source() {}
+    // 最多生成len字节放到buf中，返回生成的字节数，0表示已经结束，-1表示出错
+    virtual int read(char *buf, int len) = 0;
+};
+
+#endif // !CHUNK_SOURCE_H
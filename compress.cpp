@@ -0,0 +1,47 @@
+#include "compress.h"
+#include <string.h>
+#include <zlib.h>
+#include <brotli/encode.h>
+
+bool compress_buffer(const char *src, size_t size, CONTENT_ENCODING encoding, char *&data, size_t &len)
+{
+    char *out = NULL;
+    bool ok = false;
+    if (encoding == ENCODING_BR)
+    {
+        len = BrotliEncoderMaxCompressedSize(size);
+        out = new char[len];
+        ok = BrotliEncoderCompress(COMPRESS_BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, size, (const uint8_t *)src, &len,
+                                   (uint8_t *)out) == BROTLI_TRUE;
+    }
+    else
+    {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        // windowBits加16输出gzip格式
+        if (deflateInit2(&zs, COMPRESS_GZIP_LEVEL, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            return false;
+        }
+        len = deflateBound(&zs, size);
+        out = new char[len];
+        zs.next_in = (Bytef *)src;
+        zs.avail_in = size;
+        zs.next_out = (Bytef *)out;
+        zs.avail_out = len;
+        ok = deflate(&zs, Z_FINISH) == Z_STREAM_END;
+        len = zs.total_out;
+        deflateEnd(&zs);
+    }
+    if (!ok || len >= size)
+    {
+        delete[] out;
+        len = 0;
+        return false;
+    }
+    // 按上限申请的缓冲区大很多，复制一份正好大小的，缓存的字节数才准确
+    data = new char[len];
+    memcpy(data, out, len);
+    delete[] out;
+    return true;
+}
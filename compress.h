@@ -0,0 +1,26 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "http_conn.h"
+#include <stddef.h>
+
+// 小于这个大小的文件压缩后省不了多少，不压缩
+#define COMPRESS_MIN_FILE_SIZE 256
+// gzip压缩级别，只压缩一次，用最高的
+#define COMPRESS_GZIP_LEVEL 9
+// brotli压缩质量，11比9慢很多但小不了多少
+#define COMPRESS_BROTLI_QUALITY 9
+
+/**
+ * @brief 一次压缩整块数据
+ *
+ * @param src
+ * @param size
+ * @param encoding
+ * @param data 压缩结果，new[]分配，大小正好是len
+ * @param len
+ * @return false 压缩失败，或者压缩后没有变小
+ */
+bool compress_buffer(const char *src, size_t size, CONTENT_ENCODING encoding, char *&data, size_t &len);
+
+#endif // !COMPRESS_H
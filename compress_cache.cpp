@@ -0,0 +1,243 @@
+#include "compress_cache.h"
+
+/**
+ * @brief "ino-size-mtime"变成"ino-size-mtime-br"
+ *
+ * @param file
+ * @param encoding
+ * @param etag 至少COMPRESSED_ETAG_SIZE字节
+ * @return int ETag的长度
+ */
+int compressed_etag(const file_entry *file, CONTENT_ENCODING encoding, char *etag)
+{
+    return snprintf(etag, COMPRESSED_ETAG_SIZE, "%.*s-%s\"", file->m_etag_len - 1, file->m_etag,
+                    ENCODINGS[encoding].m_name.data());
+}
+
+compress_cache::compress_cache(file_cache *files, size_t max_bytes)
+    : m_files(files), m_max_bytes(max_bytes), m_bytes(0), m_hits(0), m_misses(0), m_stop(false), m_is_started(false)
+{
+}
+
+compress_cache::~compress_cache()
+{
+    stop();
+    // 还没处理的任务持有文件和结果的引用
+    while (!m_jobs.empty())
+    {
+        m_files->release(m_jobs.front().m_file);
+        release(m_jobs.front().m_entry);
+        m_jobs.pop_front();
+    }
+    m_locker.lock();
+    while (!m_lru.empty())
+    {
+        remove(m_lru.back());
+    }
+    m_locker.unlock();
+}
+
+bool compress_cache::start()
+{
+    if (pthread_create(&m_thread, NULL, worker, this) != 0)
+    {
+        return false;
+    }
+    m_is_started = true;
+    return true;
+}
+
+void compress_cache::stop()
+{
+    if (m_is_started)
+    {
+        m_locker.lock();
+        m_stop = true;
+        m_cond.signal();
+        m_locker.unlock();
+        pthread_join(m_thread, NULL);
+        m_is_started = false;
+    }
+}
+
+void *compress_cache::worker(void *arg)
+{
+    compress_cache *cache = (compress_cache *)arg;
+    cache->run();
+    return cache;
+}
+
+/**
+ * @brief 后台线程，一次压缩一个文件，压缩期间不持有锁
+ *
+ */
+void compress_cache::run()
+{
+    while (true)
+    {
+        m_locker.lock();
+        while (m_jobs.empty() && !m_stop)
+        {
+            m_cond.wait(m_locker.get_lock());
+        }
+        if (m_stop)
+        {
+            m_locker.unlock();
+            break;
+        }
+        job j = m_jobs.front();
+        m_jobs.pop_front();
+        m_locker.unlock();
+
+        char *data = NULL;
+        size_t len = 0;
+        compress(j.m_file, j.m_encoding, data, len);
+
+        m_locker.lock();
+        compressed_entry *entry = j.m_entry;
+        entry->m_data = data;
+        entry->m_len = len;
+        entry->m_done = true;
+        if (entry->m_cached)
+        {
+            m_bytes += len;
+            evict();
+        }
+        m_locker.unlock();
+        m_files->release(j.m_file);
+        release(entry);
+    }
+}
+
+/**
+ * @brief 压缩文件的全部内容
+ *
+ * @param file
+ * @param encoding
+ * @param data 压缩结果，大小正好是len
+ * @param len
+ * @return false 读取或压缩失败，或者压缩后没有变小
+ */
+bool compress_cache::compress(file_entry *file, CONTENT_ENCODING encoding, char *&data, size_t &len)
+{
+    // 文件不超过COMPRESS_MAX_FILE_SIZE，一定能用缓存的映射
+    const char *src = m_files->get_map(file);
+    if (src == NULL)
+    {
+        return false;
+    }
+    return compress_buffer(src, file->m_stat.st_size, encoding, data, len);
+}
+
+/**
+ * @brief 查找文件压缩后的内容
+ *
+ * @param file
+ * @param encoding
+ * @return compressed_entry* 没有压缩好时为NULL，这时已经提交给后台线程
+ */
+compressed_entry *compress_cache::acquire(file_entry *file, CONTENT_ENCODING encoding)
+{
+    const struct stat &st = file->m_stat;
+    if (st.st_size < COMPRESS_MIN_FILE_SIZE || st.st_size > COMPRESS_MAX_FILE_SIZE)
+    {
+        return NULL;
+    }
+    m_locker.lock();
+    std::unordered_map<std::string_view, compressed_entry *> &table = m_tables[encoding];
+    std::unordered_map<std::string_view, compressed_entry *>::iterator it = table.find(file->m_path);
+    if (it != table.end())
+    {
+        compressed_entry *entry = it->second;
+        if (entry->m_ino == st.st_ino && entry->m_size == st.st_size && entry->m_mtime.tv_sec == st.st_mtim.tv_sec &&
+            entry->m_mtime.tv_nsec == st.st_mtim.tv_nsec)
+        {
+            m_lru.splice(m_lru.begin(), m_lru, entry->m_lru);
+            if (entry->m_data == NULL)
+            {
+                // 还在压缩，或者压缩后没有变小
+                m_misses++;
+                m_locker.unlock();
+                return NULL;
+            }
+            entry->m_ref++;
+            m_hits++;
+            m_locker.unlock();
+            return entry;
+        }
+        // 文件变了，旧的结果不能再用
+        remove(entry);
+    }
+    m_misses++;
+    if (!m_is_started || m_jobs.size() >= COMPRESS_QUEUE_SIZE)
+    {
+        m_locker.unlock();
+        return NULL;
+    }
+    compressed_entry *entry = new compressed_entry;
+    entry->m_path = file->m_path;
+    entry->m_encoding = encoding;
+    entry->m_ino = st.st_ino;
+    entry->m_size = st.st_size;
+    entry->m_mtime = st.st_mtim;
+    entry->m_data = NULL;
+    entry->m_len = 0;
+    entry->m_done = false;
+    entry->m_etag_len = compressed_etag(file, encoding, entry->m_etag);
+    // 缓存和后台任务各一个引用
+    entry->m_ref = 2;
+    entry->m_cached = true;
+    m_lru.push_front(entry);
+    entry->m_lru = m_lru.begin();
+    table[entry->m_path] = entry;
+    file->m_ref++;
+    m_jobs.push_back({entry, file, encoding});
+    m_cond.signal();
+    m_locker.unlock();
+    return NULL;
+}
+
+void compress_cache::release(compressed_entry *entry)
+{
+    if (--entry->m_ref == 0)
+    {
+        delete[] entry->m_data;
+        delete entry;
+    }
+}
+
+void compress_cache::print_stats()
+{
+    m_locker.lock();
+    printf("压缩缓存: %zu个文件, %zu字节, 命中%ld, 未命中%ld\n", m_lru.size(), m_bytes, m_hits, m_misses);
+    m_locker.unlock();
+}
+
+/**
+ * @brief 从LRU链表尾部淘汰，直到压缩结果的字节数不超过上限。需要持有锁
+ *
+ */
+void compress_cache::evict()
+{
+    while (!m_lru.empty() && m_bytes > m_max_bytes)
+    {
+        remove(m_lru.back());
+    }
+}
+
+/**
+ * @brief 移出缓存并释放缓存的引用。需要持有锁
+ *
+ * @param entry
+ */
+void compress_cache::remove(compressed_entry *entry)
+{
+    if (entry->m_done)
+    {
+        m_bytes -= entry->m_len;
+    }
+    m_tables[entry->m_encoding].erase(entry->m_path);
+    m_lru.erase(entry->m_lru);
+    entry->m_cached = false;
+    release(entry);
+}
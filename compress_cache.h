@@ -0,0 +1,105 @@
+#ifndef COMPRESS_CACHE_H
+#define COMPRESS_CACHE_H
+
+#include "http_conn.h"
+#include "file_cache.h"
+#include "compress.h"
+#include "locker.h"
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <atomic>
+#include <deque>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+// 压缩结果占用的总字节数上限
+#define COMPRESS_CACHE_MAX_BYTES (32 * 1024 * 1024)
+// 超过这个大小的文件不压缩，一个文件不能占满缓存
+#define COMPRESS_MAX_FILE_SIZE (4 * 1024 * 1024)
+// 排队等待压缩的文件数上限，满了之后新的文件这次不压缩
+#define COMPRESS_QUEUE_SIZE 64
+// 压缩后的ETag的最大长度，原文件的ETag加上编码名
+#define COMPRESSED_ETAG_SIZE (FILE_ETAG_SIZE + 8)
+
+// 文件压缩后的ETag，只由原文件的ETag和编码决定，还没有压缩时也能用来验证条件请求
+int compressed_etag(const file_entry *file, CONTENT_ENCODING encoding, char *etag);
+
+/**
+ * @brief 压缩好的文件内容。缓存和正在发送它的连接各持有一个引用
+ */
+struct compressed_entry
+{
+    std::string m_path; // 文件路径，同一个编码的缓存中的键
+    CONTENT_ENCODING m_encoding;
+    // 压缩时文件的inode、大小和修改时间，文件变了就不能再用
+    ino_t m_ino;
+    off_t m_size;
+    struct timespec m_mtime;
+    char *m_data; // 压缩结果，还没压缩完或者压缩后没有变小时为NULL
+    size_t m_len;
+    bool m_done; // 后台线程已经处理完
+    // 原文件的ETag加上编码，不同编码的表示有不同的ETag
+    char m_etag[COMPRESSED_ETAG_SIZE];
+    int m_etag_len;
+    std::atomic<int> m_ref;
+    bool m_cached; // 是否还在缓存中
+    std::list<compressed_entry *>::iterator m_lru;
+};
+
+/**
+ * @brief 没有预压缩文件时，文本类的文件在后台线程压缩一次，结果放在内存中，按路径和修改时间缓存。
+ * 请求的线程只查找，没有压缩好时提交给后台线程，这次先返回原文件，不等待压缩
+ */
+class compress_cache
+{
+public:
+    /**
+     * @param files 文件缓存，后台线程用完文件后归还
+     * @param max_bytes 压缩结果的总字节数上限
+     */
+    compress_cache(file_cache *files, size_t max_bytes = COMPRESS_CACHE_MAX_BYTES);
+    ~compress_cache();
+    // 启动后台压缩线程
+    bool start();
+    void stop();
+
+    // 文件压缩后的内容，用完后需要release。还没有压缩好时提交压缩并返回NULL，不值得压缩时也返回NULL
+    compressed_entry *acquire(file_entry *file, CONTENT_ENCODING encoding);
+    void release(compressed_entry *entry);
+    // 打印命中统计
+    void print_stats();
+
+private:
+    struct job
+    {
+        compressed_entry *m_entry;
+        file_entry *m_file;
+        CONTENT_ENCODING m_encoding;
+    };
+
+    file_cache *m_files;
+    size_t m_max_bytes;
+    locker m_locker;
+    cond m_cond;
+    // 每种编码一个表，键指向compressed_entry::m_path，查找时不需要拼接字符串
+    std::unordered_map<std::string_view, compressed_entry *> m_tables[ENCODING_NUM];
+    std::list<compressed_entry *> m_lru; // 最近使用的在前面
+    std::deque<job> m_jobs;
+    size_t m_bytes;
+    long m_hits;
+    long m_misses;
+    bool m_stop;
+    pthread_t m_thread;
+    bool m_is_started;
+
+private:
+    static void *worker(void *arg);
+    void run();
+    bool compress(file_entry *file, CONTENT_ENCODING encoding, char *&data, size_t &len);
+    void evict();
+    void remove(compressed_entry *entry);
+};
+
+#endif // !COMPRESS_CACHE_H
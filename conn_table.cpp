@@ -0,0 +1,112 @@
+#include "conn_table.h"
+
+#define CONN_GENERATION_MASK ((1u << CONN_GENERATION_BITS) - 1)
+
+conn_table::conn_table(int max_conn) : m_max_conn(max_conn), m_slab_num(0)
+{
+    m_max_slab = (max_conn + CONN_SLAB_SIZE - 1) / CONN_SLAB_SIZE;
+    m_slabs = new std::atomic<conn_slot *>[m_max_slab];
+    for (int i = 0; i < m_max_slab; i++)
+    {
+        m_slabs[i] = NULL;
+    }
+}
+
+conn_table::~conn_table()
+{
+    for (int i = 0; i < m_slab_num; i++)
+    {
+        delete[] m_slabs[i].load();
+    }
+    delete[] m_slabs;
+}
+
+conn_table::conn_slot *conn_table::get_slot(uint32_t index)
+{
+    if (index >= (uint32_t)m_max_slab * CONN_SLAB_SIZE)
+    {
+        return NULL;
+    }
+    conn_slot *slab = m_slabs[index / CONN_SLAB_SIZE].load(std::memory_order_acquire);
+    if (slab == NULL)
+    {
+        return NULL;
+    }
+    return slab + index % CONN_SLAB_SIZE;
+}
+
+/**
+ * @brief 分配连接，没有空闲槽位时分配新的slab
+ *
+ * @param handle 新连接的句柄
+ * @return http_conn*
+ */
+http_conn *conn_table::alloc(conn_handle &handle)
+{
+    m_locker.lock();
+    if (m_free_slots.empty())
+    {
+        int slab_num = m_slab_num.load(std::memory_order_relaxed);
+        if (slab_num == m_max_slab)
+        {
+            m_locker.unlock();
+            return NULL;
+        }
+        conn_slot *slab = new conn_slot[CONN_SLAB_SIZE];
+        // 倒着放，先用编号小的槽位
+        for (int i = CONN_SLAB_SIZE - 1; i >= 0; i--)
+        {
+            slab[i].m_generation.store(0, std::memory_order_relaxed);
+            uint32_t index = slab_num * CONN_SLAB_SIZE + i;
+            if ((int)index < m_max_conn)
+            {
+                m_free_slots.push_back(index);
+            }
+        }
+        m_slabs[slab_num].store(slab, std::memory_order_release);
+        m_slab_num.store(slab_num + 1, std::memory_order_relaxed);
+    }
+    uint32_t index = m_free_slots.back();
+    m_free_slots.pop_back();
+    m_locker.unlock();
+
+    conn_slot *slot = get_slot(index);
+    uint32_t generation = (slot->m_generation.fetch_add(1, std::memory_order_acq_rel) + 1) & CONN_GENERATION_MASK;
+    handle = ((conn_handle)generation << 32) | index;
+    return &slot->m_conn;
+}
+
+void conn_table::free(http_conn *conn)
+{
+    uint32_t index = conn_handle_slot(conn->get_handle());
+    conn_slot *slot = get_slot(index);
+    if (slot == NULL || &slot->m_conn != conn)
+    {
+        return;
+    }
+    // 代数变成偶数，旧句柄失效。重复释放时代数已经对不上，不会把槽位放回两次
+    uint32_t generation = slot->m_generation.load(std::memory_order_acquire);
+    if ((generation & CONN_GENERATION_MASK) != (uint32_t)(conn->get_handle() >> 32) ||
+        !slot->m_generation.compare_exchange_strong(generation, generation + 1, std::memory_order_acq_rel))
+    {
+        return;
+    }
+    m_locker.lock();
+    m_free_slots.push_back(index);
+    m_locker.unlock();
+}
+
+http_conn *conn_table::get(conn_handle handle)
+{
+    conn_slot *slot = get_slot(conn_handle_slot(handle));
+    if (slot == NULL)
+    {
+        return NULL;
+    }
+    uint32_t generation = slot->m_generation.load(std::memory_order_acquire) & CONN_GENERATION_MASK;
+    if (generation != (uint32_t)(handle >> 32) || !(generation & 1))
+    {
+        return NULL;
+    }
+    return &slot->m_conn;
+}
@@ -0,0 +1,64 @@
+#ifndef CONN_TABLE_H
+#define CONN_TABLE_H
+
+#include "http_conn.h"
+#include "locker.h"
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+
+// 每块slab的连接数
+#define CONN_SLAB_SIZE 256
+// 句柄中代数占的位数，高8位留给io_uring的请求类型
+#define CONN_GENERATION_BITS 24
+
+/// @brief 连接句柄的槽位号
+inline uint32_t conn_handle_slot(conn_handle handle)
+{
+    return (uint32_t)handle;
+}
+
+/**
+ * @brief 连接表
+ * 连接对象按slab分块，第一次用到时才分配，关闭后放回空闲链表复用，内存随同时在线的连接数增长。
+ * 句柄 = 代数 << 32 | 槽位号，槽位每次分配和释放代数都加一，
+ * 迟到的事件、定时器拿着旧句柄查不到复用后的新连接。
+ * 正在使用的槽位代数是奇数，所以有效句柄的高32位不会是0，可以和普通fd区分开。
+ */
+class conn_table
+{
+public:
+    // max_conn 最多同时存在的连接数
+    conn_table(int max_conn);
+    ~conn_table();
+    // 分配一个连接，连接数达到上限时返回NULL
+    http_conn *alloc(conn_handle &handle);
+    // 释放连接，之后它的句柄失效
+    void free(http_conn *conn);
+    // 按句柄查找连接，句柄已经失效时返回NULL
+    http_conn *get(conn_handle handle);
+    // 已经分配的slab里的槽位数
+    int capacity() { return m_slab_num * CONN_SLAB_SIZE; }
+
+private:
+    struct conn_slot
+    {
+        http_conn m_conn;
+        std::atomic<uint32_t> m_generation;
+    };
+
+    int m_max_conn;
+    int m_max_slab;
+    // slab数组一次分配好，只有slab本身按需分配，查找时不需要加锁
+    std::atomic<conn_slot *> *m_slabs;
+    std::atomic<int> m_slab_num;
+    std::vector<uint32_t> m_free_slots;
+    locker m_locker;
+
+    conn_slot *get_slot(uint32_t index);
+};
+
+/// @brief 所有事件循环共用的连接表
+extern conn_table *conns;
+
+#endif // !CONN_TABLE_H
@@ -1,20 +1,18 @@
 #include "conn_timer.h"
 #include "http_conn.h"
-static conn_timer_list TIMER_LIST;
-static int pipefd[2] = {-1, -1};
+#include "conn_table.h"
 
-extern conn_timer_list TIMER_LIST;
-extern int pipefd[2];
-
-conn_timer::conn_timer(http_conn *user_data, time_t expire_time) : m_user_data(user_data), m_expire_time(expire_time), prev(NULL), next(NULL)
+conn_timer::conn_timer(http_conn *user_data, time_t expire_time) : m_user_data(user_data), m_handle(user_data->get_handle()), m_expire_time(expire_time), prev(NULL), next(NULL), m_slot(-1)
 {
 }
 conn_timer::conn_timer(const conn_timer &timer)
 {
     this->m_expire_time = timer.m_expire_time;
     this->m_user_data = timer.m_user_data;
-    this->next = timer.next;
-    this->prev = timer.prev;
+    this->m_handle = timer.m_handle;
+    this->next = NULL;
+    this->prev = NULL;
+    this->m_slot = -1;
 }
 
 conn_timer::~conn_timer()
@@ -24,253 +22,156 @@ conn_timer::~conn_timer()
     m_user_data = NULL;
 }
 
-conn_timer_list::conn_timer_list(/* args */) : head(NULL), tail(NULL), m_length(0)
+conn_timer_list::conn_timer_list(/* args */) : m_cur_time(time(NULL)), m_length(0)
 {
+    memset(m_slots, 0, sizeof(m_slots));
 }
 
 conn_timer_list::~conn_timer_list()
 {
-    if (!this->is_empty())
+    for (int i = 0; i < TIMER_WHEEL_SIZE; i++)
     {
-        conn_timer *head = this->get_head();
-        while (head)
+        conn_timer *cur = m_slots[i];
+        while (cur)
         {
-            this->pop_front();
-            head = this->get_head();
+            conn_timer *next = cur->next;
+            delete cur;
+            cur = next;
         }
+        m_slots[i] = NULL;
     }
-    head = NULL;
-    tail = NULL;
+    m_length = 0;
 }
 /**
- * @brief 尾插
+ * @brief 把定时器挂到到期时间对应的槽的头部
  *
  * @param timer
  */
-void conn_timer_list::push_back(conn_timer *timer)
+void conn_timer_list::link(conn_timer *timer)
 {
-    if (this->is_empty())
-    {
-        timer->next = NULL;
-        timer->prev = NULL;
-        this->head = timer;
-    }
-    else
-    {
-        timer->prev = tail;
-        tail->next = timer;
-    }
-    tail = timer;
-    this->add_length();
+    // 已经过期的定时器放到下一次会扫描的槽里
+    time_t expire = timer->m_expire_time > m_cur_time ? timer->m_expire_time : m_cur_time + 1;
+    int slot = expire & (TIMER_WHEEL_SIZE - 1);
+    timer->m_slot = slot;
+    timer->prev = NULL;
+    timer->next = m_slots[slot];
+    if (m_slots[slot] != NULL)
+    {
+        m_slots[slot]->prev = timer;
+    }
+    m_slots[slot] = timer;
+    this->m_length++;
 }
 /**
- * @brief 头插
+ * @brief 把定时器从所在的槽中摘下
  *
  * @param timer
  */
-void conn_timer_list::push_front(conn_timer *timer)
+void conn_timer_list::unlink(conn_timer *timer)
 {
-    if (this->is_empty())
+    if (timer->prev != NULL)
     {
-        timer->next = NULL;
-        timer->prev = NULL;
-        this->tail = timer;
+        timer->prev->next = timer->next;
     }
     else
     {
-        head->prev = timer;
-        timer->next = head;
+        m_slots[timer->m_slot] = timer->next;
     }
-    head = timer;
-    this->add_length();
-    return;
-}
-
-conn_timer *conn_timer_list::pop_back()
-{
-    if (!is_empty())
+    if (timer->next != NULL)
     {
-        this->sub_length();
-        conn_timer *ret = tail;
-        if (is_one_node())
-        {
-            head = NULL;
-            tail = NULL;
-        }
-        else
-        {
-            tail = tail->prev;
-            tail->next = NULL;
-            ret->prev = NULL;
-        }
-        return ret;
+        timer->next->prev = timer->prev;
     }
-    return NULL;
-}
-conn_timer *conn_timer_list::pop_front()
-{
-    if (!is_empty())
-    {
-        this->sub_length();
-        conn_timer *ret = head;
-        if (is_one_node())
-        {
-            head = NULL;
-            tail = NULL;
-        }
-        else
-        {
-            head = head->next;
-            head->prev = NULL;
-            ret->next = NULL;
-        }
-        return ret;
-    }
-    return NULL;
+    timer->prev = NULL;
+    timer->next = NULL;
+    timer->m_slot = -1;
+    this->m_length--;
 }
 /**
- * @brief 插入prev和next中间
+ * @brief 处理过期的定时器，只扫描上次处理之后到现在这段时间对应的槽
  *
- * @param prev
- * @param next
- * @param timer
  */
-void conn_timer_list::insert(conn_timer *prev, conn_timer *next, conn_timer *timer)
+void conn_timer_list::address_expired()
 {
-    if (prev != NULL)
+    time_t now = time(NULL);
+    this->lock();
+    // 间隔超过一圈时每个槽扫一遍就够了
+    time_t begin = now - m_cur_time > TIMER_WHEEL_SIZE ? now - TIMER_WHEEL_SIZE + 1 : m_cur_time + 1;
+    for (time_t t = begin; t <= now && !this->is_empty(); t++)
     {
-        timer->prev = prev;
-        prev->next = timer;
-        timer->next = next;
-        if (next != NULL)
+        conn_timer *cur = m_slots[t & (TIMER_WHEEL_SIZE - 1)];
+        while (cur)
         {
-            next->prev = timer;
-        }
-        else
-        {
-            tail = timer;
+            conn_timer *next = cur->next;
+            // 同一个槽里可能有下一圈才到期的定时器
+            if (cur->m_expire_time <= now)
+            {
+                http_conn *user = conns->get(cur->m_handle);
+                unlink(cur);
+                delete cur;
+                if (user != NULL)
+                {
+                    user->set_timer(NULL);
+                    user->close_conn();
+                }
+            }
+            cur = next;
         }
-        this->add_length();
     }
-    return;
+    m_cur_time = now;
+    this->unlock();
 }
 /**
- * @brief 处理过期的定时器
+ * @brief 添加定时器
  *
+ * @param timer
  */
-void conn_timer_list::address_expired()
+void conn_timer_list::append(conn_timer *timer)
 {
-    if (TIMER_LIST.is_empty())
+    if (timer == NULL)
     {
         return;
     }
-    conn_timer *head = TIMER_LIST.get_head();
-    time_t now = time(NULL);
-    TIMER_LIST.lock();
-    while (head && head->m_expire_time < now)
-    {
-        // TODO 断开连接
-        http_conn *user = head->m_user_data;
-        TIMER_LIST.pop_front();
-        head = TIMER_LIST.get_head();
-        user->close_conn();
-    }
-    TIMER_LIST.unlock();
+    link(timer);
 }
 /**
- * @brief 将定时器插入到合适的位置。链表expire从小到大。
+ * @brief 调整定时器的到期时间，不在时间轮中的定时器会被加入
  *
  * @param timer
+ * @param new_expire
  */
-void conn_timer_list::append(conn_timer *timer)
-{
-    if (timer == NULL)
-    {
-        return;
-    }
-    if (this->is_empty())
-    {
-        this->push_back(timer);
-        return;
-    }
-    // timer结束时间比head早，所以timer应该作为头结点
-    if (head->m_expire_time > timer->m_expire_time)
-    {
-        this->push_front(timer);
-        return;
-    }
-    conn_timer *prev = head, *next = head->next;
-    // timer一定比链表中某一个结点晚结束
-    while (prev)
-    {
-        if (prev->m_expire_time <= timer->m_expire_time)
-        {
-            if (prev == tail)
-            {
-                this->push_back(timer);
-            }
-            else
-            {
-                this->insert(prev, next, timer);
-            }
-            return;
-        }
-        prev = next;
-        next = next->next;
-    }
-    return;
-}
 void conn_timer_list::adjust_timer(conn_timer *timer, time_t new_expire)
 {
     if (timer == NULL)
     {
         return;
     }
-    conn_timer *cur = head;
-    while (cur != NULL)
+    if (timer->m_slot != -1)
     {
-        if (cur == timer)
+        if ((new_expire & (TIMER_WHEEL_SIZE - 1)) == timer->m_slot && new_expire > m_cur_time)
         {
-            if ((timer->prev != NULL && new_expire < timer->prev->m_expire_time) || (timer->next != NULL && new_expire > timer->next->m_expire_time))
-            {
-                conn_timer *new_timer = new conn_timer(*timer);
-                del_timer(timer);
-                append(timer);
-                return;
-            }
+            // 还在同一个槽，不用移动
             timer->m_expire_time = new_expire;
             return;
         }
-        cur = cur->next;
+        unlink(timer);
     }
+    timer->m_expire_time = new_expire;
+    link(timer);
 }
+/**
+ * @brief 删除并释放定时器
+ *
+ * @param timer
+ */
 void conn_timer_list::del_timer(conn_timer *timer)
 {
     if (timer == NULL)
     {
         return;
     }
-    if (timer == head)
-    {
-        this->pop_front();
-        return;
-    }
-    if (timer == tail)
+    if (timer->m_slot != -1)
     {
-        this->pop_back();
-        return;
+        unlink(timer);
     }
-    conn_timer *cur = head->next;
-    while (cur != NULL)
-    {
-        if (cur == timer)
-        {
-            cur->next = timer->next;
-            timer->next->prev = cur;
-            delete timer;
-            return;
-        }
-        cur = cur->next;
-    }
-    return;
-}
\ No newline at end of file
+    delete timer;
+}
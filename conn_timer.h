@@ -6,15 +6,21 @@
 
 #define CONN_TIMER_H
 #define TIMER_SLOT 5
+// 时间轮的槽数(2的幂)，每个槽1秒，需要大于连接超时时间TIMER_SLOT * 3
+#define TIMER_WHEEL_SIZE 64
 
 
 class conn_timer
 {
 public:
     http_conn *m_user_data;
+    // 连接的句柄，连接已经关闭(槽位可能被复用)时到期不再处理它
+    conn_handle m_handle;
     time_t m_expire_time;
     conn_timer *prev;
     conn_timer *next;
+    // 所在的时间轮槽，-1表示不在时间轮中
+    int m_slot;
 
 public:
     conn_timer(const conn_timer &timer);
@@ -22,14 +28,24 @@ public:
     ~conn_timer();
 };
 
+/**
+ * @brief 哈希时间轮。定时器按到期秒数挂到对应槽的双向链表上，
+ * 添加、调整、删除都是O(1)，处理超时只遍历已经到期的槽。
+ * 到期时间超过一圈的定时器留在槽里，扫描时按m_expire_time跳过。
+ */
 class conn_timer_list
 {
 private:
-    conn_timer *head;
-    conn_timer *tail;
+    conn_timer *m_slots[TIMER_WHEEL_SIZE];
+    // 上一次处理超时的时间，之前的槽都已经扫描过
+    time_t m_cur_time;
     int m_length;
     locker m_locker;
 
+private:
+    void link(conn_timer *timer);
+    void unlink(conn_timer *timer);
+
 public:
     conn_timer_list(/* args */);
     ~conn_timer_list();
@@ -38,19 +54,8 @@ public:
     void adjust_timer(conn_timer *timer, time_t new_expire = time(NULL) + TIMER_SLOT * 3);
     void del_timer(conn_timer *timer);
 
-    void push_back(conn_timer *timer);
-    void push_front(conn_timer *timer);
-    conn_timer *pop_back();
-    conn_timer *pop_front();
-    void insert(conn_timer *prev, conn_timer *next, conn_timer *timer);
-
-    void add_length() { m_length++; }
-    void sub_length() { m_length--; }
+    int size() { return m_length; }
     bool is_empty() { return m_length == 0; }
-    bool is_one_node() { return !is_empty() && head == tail; }
-
-    conn_timer *get_head() { return head; }
-    conn_timer *get_tail() { return tail; }
     void lock() { this->m_locker.lock(); }
     void unlock() { this->m_locker.unlock(); }
 };
@@ -0,0 +1,161 @@
+#include "dir_listing.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+/**
+ * @brief
+ *
+ * @param fd 打开的目录，失败时也由这里关闭
+ * @param url 规范化后的url，根目录为空
+ */
+dir_listing::dir_listing(int fd, std::string_view url) : m_url(url), m_pending_pos(0), m_finished(false)
+{
+    m_dir = fdopendir(fd);
+    if (m_dir == NULL)
+    {
+        close(fd);
+    }
+    if (m_url.empty() || m_url.back() != '/')
+    {
+        m_url += '/';
+    }
+    m_pending = "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>";
+    append_escaped(m_url);
+    m_pending += "</title></head>\n<body><h1>";
+    append_escaped(m_url);
+    m_pending += "</h1>\n<ul>\n";
+}
+
+dir_listing::~dir_listing()
+{
+    if (m_dir != NULL)
+    {
+        closedir(m_dir);
+    }
+}
+
+int dir_listing::read(char *buf, int len)
+{
+    if (m_dir == NULL)
+    {
+        return -1;
+    }
+    // 一次尽量填满，少发几块
+    while (m_pending.size() - m_pending_pos < (size_t)len && generate())
+    {
+    }
+    int n = std::min((size_t)len, m_pending.size() - m_pending_pos);
+    memcpy(buf, m_pending.data() + m_pending_pos, n);
+    m_pending_pos += n;
+    if (m_pending_pos == m_pending.size())
+    {
+        m_pending.clear();
+        m_pending_pos = 0;
+    }
+    return n;
+}
+
+/**
+ * @brief 读一个目录项，生成一行HTML
+ *
+ * @return false 目录已经读完
+ */
+bool dir_listing::generate()
+{
+    if (m_finished)
+    {
+        return false;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(m_dir)) != NULL)
+    {
+        std::string_view name(ent->d_name);
+        // 根目录没有上一级
+        if (name == "." || (name == ".." && m_url == "/"))
+        {
+            continue;
+        }
+        bool is_dir = ent->d_type == DT_DIR;
+        if (ent->d_type == DT_UNKNOWN || ent->d_type == DT_LNK)
+        {
+            struct stat st;
+            is_dir = fstatat(dirfd(m_dir), ent->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+        }
+        m_pending += "<li><a href=\"";
+        append_encoded(m_url);
+        append_encoded(name);
+        if (is_dir)
+        {
+            m_pending += '/';
+        }
+        m_pending += "\">";
+        append_escaped(name);
+        if (is_dir)
+        {
+            m_pending += '/';
+        }
+        m_pending += "</a></li>\n";
+        return true;
+    }
+    m_pending += "</ul>\n</body></html>\n";
+    m_finished = true;
+    return true;
+}
+
+/**
+ * @brief 追加百分号编码后的路径，文件名里的空格、%、?、#等在链接中会被当成url的一部分。
+ * 编码后只剩字母数字和-._~/，不需要再做HTML转义
+ *
+ * @param str
+ */
+void dir_listing::append_encoded(std::string_view str)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    for (unsigned char c : str)
+    {
+        if (isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~' || c == '/')
+        {
+            m_pending += c;
+        }
+        else
+        {
+            m_pending += '%';
+            m_pending += hex[c >> 4];
+            m_pending += hex[c & 15];
+        }
+    }
+}
+
+/**
+ * @brief 追加HTML转义后的字符串，文件名里可能有<>&"
+ *
+ * @param str
+ */
+void dir_listing::append_escaped(std::string_view str)
+{
+    for (char c : str)
+    {
+        switch (c)
+        {
+        case '<':
+            m_pending += "&lt;";
+            break;
+        case '>':
+            m_pending += "&gt;";
+            break;
+        case '&':
+            m_pending += "&amp;";
+            break;
+        case '"':
+            m_pending += "&quot;";
+            break;
+        default:
+            m_pending += c;
+            break;
+        }
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef DIR_LISTING_H
+#define DIR_LISTING_H
+
+#include "chunk_source.h"
+#include <dirent.h>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief 目录列表，边读目录边生成HTML，大目录也不需要先把整个页面放在内存里
+ */
+class dir_listing : public chunk_source
+{
+public:
+    // fd 打开的目录，由dir_listing关闭；url 规范化后的目录url，用来生成链接
+    dir_listing(int fd, std::string_view url);
+    ~dir_listing();
+    int read(char *buf, int len) override;
+
+private:
+    DIR *m_dir;
+    std::string m_url;
+    // 已经生成还没有取走的HTML
+    std::string m_pending;
+    size_t m_pending_pos;
+    bool m_finished;
+
+    bool generate();
+    void append_encoded(std::string_view str);
+    void append_escaped(std::string_view str);
+};
+
+#endif // !DIR_LISTING_H
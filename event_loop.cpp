@@ -0,0 +1,305 @@
+#include "event_loop.h"
+#include "http_response.h"
+#include <sys/eventfd.h>
+
+event_loop::event_loop(int port, threadpool<http_conn> *pool) : m_port(port), m_listen_fd(-1), m_epoll_fd(-1), m_wakeup_fd(-1), m_pool(pool),
+                                                                 m_next_tick(0), m_is_started(false), m_is_stop(false)
+{
+}
+
+event_loop::~event_loop()
+{
+    if (m_wakeup_fd != -1)
+    {
+        close(m_wakeup_fd);
+    }
+    if (m_epoll_fd != -1)
+    {
+        close(m_epoll_fd);
+    }
+    if (m_listen_fd != -1)
+    {
+        close(m_listen_fd);
+    }
+}
+
+/**
+ * @brief 创建监听socket和epoll。每个事件循环都bind同一个端口，依靠SO_REUSEPORT由内核分配连接
+ *
+ * @return true 成功
+ * @return false 失败
+ */
+bool event_loop::init()
+{
+    // 申请用于监听的文件描述符
+    m_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (m_listen_fd == -1)
+    {
+        perror("socket");
+        return false;
+    }
+
+    // 设置端口复用
+    int opt = 1;
+    setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+
+    sockaddr_in server_addr;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(m_port);
+
+    if (bind(m_listen_fd, (sockaddr *)&server_addr, sizeof(server_addr)) == -1)
+    {
+        perror("bind");
+        return false;
+    }
+
+    // 监听
+    if (listen(m_listen_fd, 1024) == -1)
+    {
+        perror("listen");
+        return false;
+    }
+
+    // 创建epoll
+    m_epoll_fd = epoll_create(MAX_USER_NUM);
+    if (m_epoll_fd == -1)
+    {
+        perror("epoll_create");
+        return false;
+    }
+    // 监听描述符不应该oneshot
+    epoll_add(m_epoll_fd, m_listen_fd, m_listen_fd, false);
+
+    m_wakeup_fd = eventfd(0, EFD_NONBLOCK);
+    if (m_wakeup_fd == -1)
+    {
+        perror("eventfd");
+        return false;
+    }
+    epoll_add(m_epoll_fd, m_wakeup_fd, m_wakeup_fd, false);
+    m_prefetch_done.set_wakeup_fd(m_wakeup_fd);
+    printf("listen_fd = %d, epoll_fd = %d\n", m_listen_fd, m_epoll_fd);
+    return true;
+}
+
+bool event_loop::start()
+{
+    if (pthread_create(&m_thread, NULL, worker, this) != 0)
+    {
+        return false;
+    }
+    m_is_started = true;
+    return true;
+}
+
+void *event_loop::worker(void *arg)
+{
+    event_loop *loop = (event_loop *)arg;
+    loop->run();
+    return loop;
+}
+
+void event_loop::stop()
+{
+    m_is_stop = true;
+    eventfd_write(m_wakeup_fd, 1);
+}
+
+void event_loop::join()
+{
+    if (m_is_started)
+    {
+        pthread_join(m_thread, NULL);
+        m_is_started = false;
+    }
+}
+
+void event_loop::run()
+{
+    m_next_tick = time(NULL) + TIMER_SLOT;
+    while (!m_is_stop)
+    {
+        // 用epoll_wait的超时代替SIGALRM，每个事件循环各自处理自己的定时器
+        int num = epoll_wait(m_epoll_fd, m_events, MAX_EVENT_NUM, TIMER_SLOT * 1000);
+        if (num == -1 && errno != EINTR)
+        {
+            printf("epoll failure\n");
+            break;
+        }
+        // 醒来先刷新Date，秒数没变时只是一次time调用
+        http_date::update();
+
+        for (int i = 0; i < num; i++)
+        {
+            uint64_t data = m_events[i].data.u64;
+
+            if (data == (uint64_t)m_listen_fd)
+            {
+                // 有新的连接
+                deal_accept();
+                continue;
+            }
+            else if (data == (uint64_t)m_wakeup_fd)
+            {
+                eventfd_t value;
+                eventfd_read(m_wakeup_fd, &value);
+                deal_prefetch_done();
+                continue;
+            }
+            // 连接已经关闭、槽位被复用时句柄对不上，丢掉这个事件
+            http_conn *conn = conns->get(data);
+            if (conn == NULL)
+            {
+                continue;
+            }
+            if (m_events[i].events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR))
+            {
+                // 客户端断开或错误
+                close_conn(conn);
+            }
+            else if (m_events[i].events & EPOLLIN)
+            {
+                deal_read(conn);
+            }
+            else if (m_events[i].events & EPOLLOUT)
+            {
+                deal_write(conn);
+            }
+        }
+        tick();
+    }
+}
+
+void event_loop::deal_accept()
+{
+    sockaddr_in addr;
+    socklen_t size = sizeof(addr);
+    int sockfd = accept(m_listen_fd, (sockaddr *)&addr, &size);
+    if (sockfd == -1)
+    {
+        return;
+    }
+    conn_handle handle;
+    http_conn *conn = conns->alloc(handle);
+    if (conn == NULL)
+    {
+        // 可以给客户端提示
+        printf("服务器正忙\n");
+        close(sockfd);
+        return;
+    }
+
+    // 记录新的连接信息
+    conn->init(sockfd, addr, m_epoll_fd, handle, &m_prefetch_done);
+    conn_timer *timer = new conn_timer(conn);
+    m_timer_list.append(timer);
+    conn->set_timer(timer);
+}
+
+void event_loop::deal_read(http_conn *conn)
+{
+    // 检测到读事件
+    if (conn->read())
+    {
+        // 先取出定时器，交给线程池之后连接可能被工作线程关闭
+        conn_timer *timer = conn->get_timer();
+        // 一次性读完数据
+        deal_request(conn);
+        // 默认更新15s
+        m_timer_list.adjust_timer(timer);
+    }
+    else
+    {
+        // read失败
+        close_conn(conn);
+    }
+}
+
+void event_loop::deal_write(http_conn *conn)
+{
+    // 检测到写事件
+    if (conn->write())
+    {
+        conn_timer *timer = conn->get_timer();
+        // 默认更新15s
+        m_timer_list.adjust_timer(timer);
+        // 已经收到的流水线请求，交给工作线程后连接可能随时关闭，放在最后
+        if (conn->has_pending_input())
+        {
+            deal_request(conn);
+        }
+    }
+    else
+    {
+        // 写失败
+        close_conn(conn);
+    }
+}
+
+/**
+ * @brief 预读完成的连接接着发送。等预读时连接没有注册事件，只可能被本线程的定时器关闭，
+ * 这里查连接表确认它还在，不会给复用了fd的新连接注册事件
+ *
+ */
+void event_loop::deal_prefetch_done()
+{
+    m_prefetch_done.take(m_prefetch_results);
+    for (const prefetch_done_queue::result &r : m_prefetch_results)
+    {
+        http_conn *conn = conns->get(r.m_handle);
+        if (conn == NULL)
+        {
+            continue;
+        }
+        if (!r.m_ok)
+        {
+            conn->prefetch_failed();
+        }
+        deal_write(conn);
+    }
+}
+
+/**
+ * @brief 有线程池时交给工作线程解析，否则在本循环线程中直接处理
+ *
+ * @param conn
+ */
+void event_loop::deal_request(http_conn *conn)
+{
+    if (m_pool != NULL)
+    {
+        m_pool->append(conn);
+    }
+    else
+    {
+        conn->process();
+    }
+}
+
+/**
+ * @brief 关闭连接并删除它的定时器
+ *
+ * @param conn
+ */
+void event_loop::close_conn(http_conn *conn)
+{
+    m_timer_list.del_timer(conn->get_timer());
+    conn->set_timer(NULL);
+    conn->close_conn();
+}
+
+/**
+ * @brief 处理超时连接
+ *
+ */
+void event_loop::tick()
+{
+    time_t now = time(NULL);
+    if (now < m_next_tick)
+    {
+        return;
+    }
+    m_timer_list.address_expired();
+    m_next_tick = now + TIMER_SLOT;
+}
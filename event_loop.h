@@ -0,0 +1,75 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include "http_conn.h"
+#include "threadpool.h"
+#include "conn_timer.h"
+#include "conn_table.h"
+#include "prefetcher.h"
+#include <pthread.h>
+#include <sys/epoll.h>
+
+#define MAX_USER_NUM 65534
+#define MAX_EVENT_NUM 10000
+
+/**
+ * @brief 事件循环(reactor)
+ * 每个事件循环拥有自己的epoll、SO_REUSEPORT监听socket、连接和定时器，
+ * 由内核在多个监听socket之间分配新连接。
+ */
+class event_loop
+{
+public:
+    /**
+     * @param port 监听端口
+     * @param pool 线程池，为NULL时请求直接在事件循环线程中处理
+     */
+    event_loop(int port, threadpool<http_conn> *pool = NULL);
+    ~event_loop();
+    // 创建监听socket、epoll
+    bool init();
+    // 在新线程中运行事件循环
+    bool start();
+    // 事件循环主体
+    void run();
+    // 通知事件循环退出
+    void stop();
+    // 等待事件循环线程退出
+    void join();
+
+private:
+    // 监听端口
+    int m_port;
+    // 本循环的监听socket
+    int m_listen_fd;
+    // 本循环的epoll
+    int m_epoll_fd;
+    // 用于唤醒epoll_wait的eventfd
+    int m_wakeup_fd;
+    // 预读完成的连接，预读线程放入后写m_wakeup_fd
+    prefetch_done_queue m_prefetch_done;
+    std::vector<prefetch_done_queue::result> m_prefetch_results;
+    // 线程池
+    threadpool<http_conn> *m_pool;
+    // 本循环的连接定时器
+    conn_timer_list m_timer_list;
+    // 下一次处理超时连接的时间
+    time_t m_next_tick;
+    epoll_event m_events[MAX_EVENT_NUM];
+    pthread_t m_thread;
+    bool m_is_started;
+    volatile bool m_is_stop;
+
+private:
+    // 线程入口
+    static void *worker(void *arg);
+    void deal_accept();
+    void deal_read(http_conn *conn);
+    void deal_write(http_conn *conn);
+    void deal_request(http_conn *conn);
+    void close_conn(http_conn *conn);
+    void deal_prefetch_done();
+    void tick();
+};
+
+#endif // !EVENT_LOOP_H
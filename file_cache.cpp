@@ -0,0 +1,854 @@
+#include "file_cache.h"
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <functional>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+
+// 会让缓存的文件内容或属性失效的事件
+#define FILE_CACHE_WATCH_MASK (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+file_cache::file_cache(const std::string &root, int max_entries, size_t max_bytes, size_t response_file_size, size_t max_response_bytes)
+    : m_root(root), m_max_entries(max_entries / FILE_CACHE_SHARD_NUM + 1), m_max_missing(FILE_CACHE_MAX_MISSING / FILE_CACHE_SHARD_NUM), m_max_bytes(max_bytes / FILE_CACHE_SHARD_NUM),
+      m_response_file_size(response_file_size), m_max_response_bytes(max_response_bytes / FILE_CACHE_SHARD_NUM), m_enabled(false), m_use_openat2(true), m_inotify_fd(-1), m_wakeup_fd(-1), m_is_started(false)
+{
+    // 之后所有的文件都相对它打开，不再拼接、解析根目录的路径
+    m_root_fd = open(root.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (m_root_fd == -1)
+    {
+        perror("open root");
+    }
+    for (int i = 0; i < FILE_CACHE_SHARD_NUM; i++)
+    {
+        m_shards[i].m_bytes = 0;
+        m_shards[i].m_response_bytes = 0;
+        m_shards[i].m_hits = 0;
+        m_shards[i].m_misses = 0;
+        m_shards[i].m_response_hits = 0;
+        m_shards[i].m_response_misses = 0;
+        m_shards[i].m_missing_hits = 0;
+        m_shards[i].m_generation = 0;
+    }
+}
+
+file_cache::~file_cache()
+{
+    stop();
+    clear();
+    if (m_inotify_fd != -1)
+    {
+        close(m_inotify_fd);
+    }
+    if (m_wakeup_fd != -1)
+    {
+        close(m_wakeup_fd);
+    }
+    if (m_root_fd != -1)
+    {
+        close(m_root_fd);
+    }
+}
+
+bool file_cache::start()
+{
+    m_inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (m_inotify_fd == -1)
+    {
+        perror("inotify_init1");
+        return false;
+    }
+    m_wakeup_fd = eventfd(0, EFD_NONBLOCK);
+    if (m_wakeup_fd == -1)
+    {
+        perror("eventfd");
+        return false;
+    }
+    if (!watch_dir(""))
+    {
+        return false;
+    }
+    if (pthread_create(&m_thread, NULL, worker, this) != 0)
+    {
+        return false;
+    }
+    m_is_started = true;
+    m_enabled = true;
+    return true;
+}
+
+void file_cache::stop()
+{
+    if (m_is_started)
+    {
+        eventfd_write(m_wakeup_fd, 1);
+        pthread_join(m_thread, NULL);
+        m_is_started = false;
+    }
+    m_enabled = false;
+}
+
+void *file_cache::worker(void *arg)
+{
+    file_cache *cache = (file_cache *)arg;
+    cache->run();
+    return cache;
+}
+
+/**
+ * @brief 监视线程，把inotify事件转换成缓存失效
+ *
+ */
+void file_cache::run()
+{
+    // inotify_event需要按它的类型对齐
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd fds[2];
+    fds[0].fd = m_inotify_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = m_wakeup_fd;
+    fds[1].events = POLLIN;
+    while (true)
+    {
+        if (poll(fds, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            break;
+        }
+        ssize_t len = ::read(m_inotify_fd, buf, sizeof(buf));
+        if (len <= 0)
+        {
+            continue;
+        }
+        for (char *p = buf; p < buf + len;)
+        {
+            struct inotify_event *event = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                // 丢了事件，不知道哪些文件变了
+                clear();
+                clear_missing();
+                continue;
+            }
+            // 相对根目录的路径，根目录本身为空
+            std::string dir;
+            bool watched = false;
+            m_watch_locker.lock();
+            std::unordered_map<int, std::string>::iterator it = m_watch_dirs.find(event->wd);
+            if (it != m_watch_dirs.end())
+            {
+                dir = it->second;
+                watched = true;
+                if (event->mask & IN_IGNORED)
+                {
+                    // 目录被删除或者监视被移除，下次访问时重新监视
+                    m_dir_watches.erase(dir);
+                    m_watch_dirs.erase(it);
+                }
+            }
+            m_watch_locker.unlock();
+            if (!watched)
+            {
+                continue;
+            }
+
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+            {
+                // 目录本身没了，它下面缓存的路径都不再可信
+                if (event->mask & IN_MOVE_SELF)
+                {
+                    inotify_rm_watch(m_inotify_fd, event->wd);
+                }
+                clear();
+            }
+            else if (event->len > 0)
+            {
+                invalidate(dir + "/" + event->name);
+                if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)))
+                {
+                    // 新目录下的路径可能之前被记成不存在，那时它还没有被监视
+                    clear_missing();
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief 把url转换成相对根目录的路径，合并多余的/、.和..
+ *
+ * @param url 已经去掉查询参数并解码
+ * @param path 至少url.size() + 2字节，结果以/开头(根目录本身为空)，以\0结尾
+ * @return int 路径长度，..超出了根目录时返回-1
+ */
+int normalize_url(std::string_view url, char *path)
+{
+    size_t len = 0;
+    size_t begin = 0;
+    while (begin < url.size())
+    {
+        size_t end = url.find('/', begin);
+        if (end == std::string_view::npos)
+        {
+            end = url.size();
+        }
+        std::string_view segment = url.substr(begin, end - begin);
+        begin = end + 1;
+        if (segment.empty() || segment == ".")
+        {
+            continue;
+        }
+        if (segment == "..")
+        {
+            if (len == 0)
+            {
+                return -1;
+            }
+            while (path[--len] != '/')
+            {
+            }
+            continue;
+        }
+        path[len++] = '/';
+        memcpy(path + len, segment.data(), segment.size());
+        len += segment.size();
+    }
+    path[len] = '\0';
+    return len;
+}
+
+file_cache::shard &file_cache::get_shard(std::string_view path)
+{
+    return m_shards[std::hash<std::string_view>()(path) & (FILE_CACHE_SHARD_NUM - 1)];
+}
+
+/**
+ * @brief 在根目录下打开文件。openat2的RESOLVE_BENEATH保证解析(包括符号链接)不离开根目录，
+ * 路径只走一遍，不用先stat再open
+ *
+ * @param path 相对根目录的路径，不以/开头，根目录本身为"."
+ * @param flags
+ * @return int 失败时为-1，errno说明原因
+ */
+int file_cache::open_beneath(const char *path, int flags)
+{
+    if (m_use_openat2.load(std::memory_order_relaxed))
+    {
+        struct open_how how;
+        memset(&how, 0, sizeof(how));
+        how.flags = flags;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+        int fd = syscall(SYS_openat2, m_root_fd, path, &how, sizeof(how));
+        if (fd != -1 || errno != ENOSYS)
+        {
+            return fd;
+        }
+        // 内核早于5.6，没有openat2
+        m_use_openat2.store(false, std::memory_order_relaxed);
+    }
+    // 路径已经规范化，不含..，只是拦不住指向根目录外的符号链接
+    return openat(m_root_fd, path, flags);
+}
+
+/**
+ * @brief 监视目录，已经监视的直接返回
+ *
+ * @param path 相对根目录的路径，根目录本身为空
+ * @return true 成功
+ */
+bool file_cache::watch_dir(std::string_view path)
+{
+    m_watch_locker.lock();
+    bool ok = true;
+    std::string dir(path);
+    if (m_dir_watches.find(dir) == m_dir_watches.end())
+    {
+        int wd = inotify_add_watch(m_inotify_fd, (m_root + dir).c_str(), FILE_CACHE_WATCH_MASK | IN_ONLYDIR);
+        if (wd == -1)
+        {
+            ok = false;
+        }
+        else
+        {
+            m_dir_watches[dir] = wd;
+            m_watch_dirs[wd] = dir;
+        }
+    }
+    m_watch_locker.unlock();
+    return ok;
+}
+
+/**
+ * @brief 查找url对应的文件。未命中时打开文件并放入缓存
+ *
+ * @param url 请求的url
+ * @param entry 成功时为持有一个引用的文件
+ * @param mem 规范化路径用的临时内存
+ * @return HTTP_CODE
+ */
+HTTP_CODE file_cache::acquire(std::string_view url, file_entry *&entry, arena &mem)
+{
+    char *path_buf = (char *)mem.alloc(url.size() + 2, 1);
+    int len = normalize_url(url, path_buf);
+    if (len < 0)
+    {
+        return HTTP_CODE::BAD_REQUEST;
+    }
+    std::string_view path(path_buf, len);
+    if (path.empty())
+    {
+        // 根目录本身
+        return HTTP_CODE::DIR_REQUEST;
+    }
+
+    shard &s = get_shard(path);
+    unsigned generation = 0;
+    if (m_enabled)
+    {
+        s.m_locker.lock();
+        std::unordered_map<std::string_view, file_entry *>::iterator it = s.m_table.find(path);
+        if (it != s.m_table.end())
+        {
+            entry = it->second;
+            entry->m_ref++;
+            s.m_lru.splice(s.m_lru.begin(), s.m_lru, entry->m_lru);
+            s.m_hits++;
+            s.m_locker.unlock();
+            return HTTP_CODE::FILE_REQUEST;
+        }
+        if (find_missing(s, path))
+        {
+            s.m_missing_hits++;
+            s.m_locker.unlock();
+            return HTTP_CODE::NO_RESOURCE;
+        }
+        generation = s.m_generation;
+        s.m_misses++;
+        s.m_locker.unlock();
+    }
+
+    // 先监视目录再打开文件，打开之后的修改一定能收到事件
+    bool cacheable = m_enabled && watch_dir(path.substr(0, path.rfind('/')));
+    // O_NONBLOCK让打开FIFO不会阻塞，下面fstat发现不是普通文件就拒绝
+    int fd = open_beneath(path_buf + 1, O_RDONLY | O_CLOEXEC | O_NONBLOCK | O_NOCTTY);
+    if (fd == -1)
+    {
+        if (errno == EACCES || errno == EXDEV || errno == ELOOP)
+        {
+            // 没有权限，或者符号链接指向根目录外
+            return HTTP_CODE::FORBIDDEN_REQUEST;
+        }
+        if (m_enabled && (errno == ENOENT || errno == ENOTDIR))
+        {
+            s.m_locker.lock();
+            // 查找期间有路径被创建，可能就是这个，这次不记
+            if (s.m_generation == generation)
+            {
+                add_missing(s, path);
+            }
+            s.m_locker.unlock();
+        }
+        return HTTP_CODE::NO_RESOURCE;
+    }
+    // 属性来自打开的fd，验证器和实际发送的文件一致
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return HTTP_CODE::NO_RESOURCE;
+    }
+    if (!(st.st_mode & S_IROTH))
+    {
+        close(fd);
+        return HTTP_CODE::FORBIDDEN_REQUEST;
+    }
+    if (S_ISDIR(st.st_mode))
+    {
+        close(fd);
+        return HTTP_CODE::DIR_REQUEST;
+    }
+    if (!S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return HTTP_CODE::FORBIDDEN_REQUEST;
+    }
+
+    file_entry *e = new file_entry;
+    e->m_path = path;
+    e->m_fd = fd;
+    e->m_stat = st;
+    e->m_etag_len = snprintf(e->m_etag, sizeof(e->m_etag), "\"%lx-%lx-%lx\"", (unsigned long)st.st_ino, (unsigned long)st.st_size,
+                             (unsigned long)(st.st_mtim.tv_sec * 1000000000L + st.st_mtim.tv_nsec));
+    format_http_date(st.st_mtime, e->m_last_modified);
+    e->m_addr = NULL;
+    e->m_response = NULL;
+    e->m_response_len = 0;
+    e->m_response_head_len = 0;
+    for (int i = 0; i < ENCODING_NUM; i++)
+    {
+        e->m_variants[i] = NULL;
+    }
+    e->m_variants_checked = 0;
+    // 调用者的引用
+    e->m_ref = 1;
+    e->m_cached = false;
+    entry = e;
+    if (!cacheable)
+    {
+        return HTTP_CODE::FILE_REQUEST;
+    }
+
+    s.m_locker.lock();
+    if (s.m_generation != generation)
+    {
+        // 打开期间有文件失效，可能就是这个文件，这次不缓存
+        s.m_locker.unlock();
+        return HTTP_CODE::FILE_REQUEST;
+    }
+    std::unordered_map<std::string_view, file_entry *>::iterator it = s.m_table.find(path);
+    if (it != s.m_table.end())
+    {
+        // 其他线程已经放入缓存
+        entry = it->second;
+        entry->m_ref++;
+        s.m_locker.unlock();
+        release(e);
+        return HTTP_CODE::FILE_REQUEST;
+    }
+    // 缓存的引用
+    e->m_ref++;
+    e->m_cached = true;
+    s.m_lru.push_front(e);
+    e->m_lru = s.m_lru.begin();
+    s.m_table[e->m_path] = e;
+    evict(s);
+    s.m_locker.unlock();
+    return HTTP_CODE::FILE_REQUEST;
+}
+
+/**
+ * @brief 打开url对应的目录，目录不缓存
+ *
+ * @param url 请求的url
+ * @param mem 规范化路径用的临时内存
+ * @param dir_url 规范化后相对根目录的路径，根目录为空
+ * @return int 目录的fd，失败时为-1
+ */
+int file_cache::open_dir(std::string_view url, arena &mem, std::string_view &dir_url)
+{
+    char *path_buf = (char *)mem.alloc(url.size() + 2, 1);
+    int len = normalize_url(url, path_buf);
+    if (len < 0)
+    {
+        return -1;
+    }
+    dir_url = std::string_view(path_buf, len);
+    return open_beneath(len == 0 ? "." : path_buf + 1, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+void file_cache::release(file_entry *entry)
+{
+    if (--entry->m_ref == 0)
+    {
+        if (entry->m_addr != NULL)
+        {
+            munmap(entry->m_addr, entry->m_stat.st_size);
+        }
+        delete[] entry->m_response;
+        for (int i = 0; i < ENCODING_NUM; i++)
+        {
+            if (entry->m_variants[i] != NULL)
+            {
+                release(entry->m_variants[i]);
+            }
+        }
+        close(entry->m_fd);
+        delete entry;
+    }
+}
+
+/**
+ * @brief 查找预压缩的兄弟文件。结果记在缓存的文件上，之后不用再查找；
+ * 兄弟文件出现或者变化时原文件也会失效，见invalidate
+ *
+ * @param entry 原文件
+ * @param encoding
+ * @param mem 拼接路径用的临时内存
+ * @return file_entry* 持有一个引用，没有时为NULL
+ */
+file_entry *file_cache::get_variant(file_entry *entry, CONTENT_ENCODING encoding, arena &mem)
+{
+    shard &s = get_shard(entry->m_path);
+    unsigned bit = 1u << encoding;
+    s.m_locker.lock();
+    if (entry->m_variants_checked & bit)
+    {
+        file_entry *variant = entry->m_variants[encoding];
+        if (variant != NULL)
+        {
+            variant->m_ref++;
+        }
+        s.m_locker.unlock();
+        return variant;
+    }
+    s.m_locker.unlock();
+
+    // 兄弟文件可能在另一个分片，查找时不能持有这个分片的锁
+    std::string_view url = entry->m_path;
+    std::string_view suffix = ENCODINGS[encoding].m_suffix;
+    char *variant_url = (char *)mem.alloc(url.size() + suffix.size(), 1);
+    memcpy(variant_url, url.data(), url.size());
+    memcpy(variant_url + url.size(), suffix.data(), suffix.size());
+    file_entry *variant = NULL;
+    if (acquire(std::string_view(variant_url, url.size() + suffix.size()), variant, mem) != HTTP_CODE::FILE_REQUEST)
+    {
+        variant = NULL;
+    }
+
+    s.m_locker.lock();
+    // 已经失效的文件不记，兄弟文件可能就是在查找期间出现的
+    if (entry->m_cached && !(entry->m_variants_checked & bit))
+    {
+        entry->m_variants[encoding] = variant;
+        entry->m_variants_checked |= bit;
+        if (variant != NULL)
+        {
+            variant->m_ref++;
+        }
+    }
+    s.m_locker.unlock();
+    return variant;
+}
+
+/**
+ * @brief 获取文件的共享映射，第一次调用时映射。
+ * mmap在锁外做，不让同一分片的其他文件等它，同时映射的连接只留一个，其余的解除
+ *
+ * @param entry
+ * @return char* 文件太大或映射失败时为NULL
+ */
+char *file_cache::get_map(file_entry *entry)
+{
+    if (entry->m_stat.st_size == 0 || entry->m_stat.st_size > FILE_CACHE_MAX_MAP_SIZE)
+    {
+        return NULL;
+    }
+    shard &s = get_shard(entry->m_path);
+    s.m_locker.lock();
+    char *addr = entry->m_addr;
+    s.m_locker.unlock();
+    if (addr != NULL)
+    {
+        return addr;
+    }
+
+    // 调用者持有引用，fd在锁外也有效
+    void *map = mmap(NULL, entry->m_stat.st_size, PROT_READ, MAP_PRIVATE, entry->m_fd, 0);
+    if (map == MAP_FAILED)
+    {
+        return NULL;
+    }
+    s.m_locker.lock();
+    if (entry->m_addr == NULL)
+    {
+        entry->m_addr = (char *)map;
+        map = NULL;
+        if (entry->m_cached)
+        {
+            s.m_bytes += entry->m_stat.st_size;
+            evict(s);
+        }
+    }
+    addr = entry->m_addr;
+    s.m_locker.unlock();
+    if (map != NULL)
+    {
+        munmap(map, entry->m_stat.st_size);
+    }
+    return addr;
+}
+
+bool file_cache::can_cache_response(const file_entry *entry) const
+{
+    return m_response_file_size > 0 && (size_t)entry->m_stat.st_size <= m_response_file_size;
+}
+
+/**
+ * @brief 查找缓存的响应
+ *
+ * @param entry
+ * @param len 响应长度
+ * @param head_len 响应头的长度
+ * @return const char* 还没有生成时为NULL
+ */
+const char *file_cache::get_response(file_entry *entry, size_t &len, size_t &head_len)
+{
+    shard &s = get_shard(entry->m_path);
+    s.m_locker.lock();
+    const char *response = entry->m_response;
+    len = entry->m_response_len;
+    head_len = entry->m_response_head_len;
+    if (response != NULL)
+    {
+        s.m_response_hits++;
+    }
+    else
+    {
+        s.m_response_misses++;
+    }
+    s.m_locker.unlock();
+    return response;
+}
+
+/**
+ * @brief 把响应头和文件内容拼成一块连续的缓冲区放入缓存。
+ * 读文件在锁外做，页缓存未命中时不让同一分片的其他请求等磁盘。
+ * 读完再检查一次，文件已经失效或者别的连接先放入了就用已有的
+ *
+ * @param entry
+ * @param header 状态行和响应头
+ * @param len 响应长度
+ * @param head_len 响应头的长度
+ * @return const char* 文件已经不在缓存中或读取失败时为NULL
+ */
+const char *file_cache::set_response(file_entry *entry, std::string_view header, size_t &len, size_t &head_len)
+{
+    size_t size = entry->m_stat.st_size;
+    if (!can_cache_response(entry))
+    {
+        return NULL;
+    }
+    shard &s = get_shard(entry->m_path);
+    s.m_locker.lock();
+    // 已经失效的文件不再生成，否则内存不受上限控制
+    bool need = entry->m_response == NULL && entry->m_cached;
+    s.m_locker.unlock();
+
+    char *buf = NULL;
+    if (need)
+    {
+        buf = new char[header.size() + size];
+        memcpy(buf, header.data(), header.size());
+        size_t offset = 0;
+        while (offset < size)
+        {
+            ssize_t n = pread(entry->m_fd, buf + header.size() + offset, size - offset, offset);
+            if (n <= 0)
+            {
+                break;
+            }
+            offset += n;
+        }
+        if (offset != size)
+        {
+            // 文件被截断了
+            delete[] buf;
+            buf = NULL;
+        }
+    }
+
+    s.m_locker.lock();
+    if (buf != NULL && entry->m_response == NULL && entry->m_cached)
+    {
+        entry->m_response = buf;
+        entry->m_response_len = header.size() + size;
+        entry->m_response_head_len = header.size();
+        s.m_response_bytes += entry->m_response_len;
+        buf = NULL;
+        evict(s);
+    }
+    const char *response = entry->m_response;
+    len = entry->m_response_len;
+    head_len = entry->m_response_head_len;
+    s.m_locker.unlock();
+    delete[] buf;
+    return response;
+}
+
+void file_cache::print_stats()
+{
+    long hits = 0, misses = 0, response_hits = 0, response_misses = 0, missing_hits = 0;
+    size_t bytes = 0, response_bytes = 0, missing = 0;
+    int entries = 0;
+    for (int i = 0; i < FILE_CACHE_SHARD_NUM; i++)
+    {
+        shard &s = m_shards[i];
+        s.m_locker.lock();
+        hits += s.m_hits;
+        misses += s.m_misses;
+        response_hits += s.m_response_hits;
+        response_misses += s.m_response_misses;
+        bytes += s.m_bytes;
+        response_bytes += s.m_response_bytes;
+        entries += s.m_table.size();
+        missing_hits += s.m_missing_hits;
+        missing += s.m_missing.size();
+        s.m_locker.unlock();
+    }
+    printf("文件缓存: %d个文件, 映射%zu字节, 命中%ld, 未命中%ld\n", entries, bytes, hits, misses);
+    printf("响应缓存: %zu字节, 命中%ld, 未命中%ld\n", response_bytes, response_hits, response_misses);
+    printf("不存在的路径: %zu个, 命中%ld\n", missing, missing_hits);
+}
+
+/**
+ * @brief 从LRU链表尾部淘汰，直到文件数、映射字节数和响应字节数都不超过上限。需要持有分片的锁
+ *
+ * @param s
+ */
+void file_cache::evict(shard &s)
+{
+    while (!s.m_lru.empty() && ((int)s.m_table.size() > m_max_entries || s.m_bytes > m_max_bytes || s.m_response_bytes > m_max_response_bytes))
+    {
+        remove(s, s.m_lru.back());
+    }
+}
+
+/**
+ * @brief 把文件移出缓存并释放缓存的引用。需要持有分片的锁
+ *
+ * @param s
+ * @param entry
+ */
+void file_cache::remove(shard &s, file_entry *entry)
+{
+    if (entry->m_addr != NULL)
+    {
+        s.m_bytes -= entry->m_stat.st_size;
+    }
+    s.m_response_bytes -= entry->m_response_len;
+    s.m_table.erase(entry->m_path);
+    s.m_lru.erase(entry->m_lru);
+    entry->m_cached = false;
+    release(entry);
+}
+
+/**
+ * @brief 文件变化，从缓存中去掉
+ *
+ * @param path
+ */
+void file_cache::invalidate(std::string_view path)
+{
+    shard &s = get_shard(path);
+    s.m_locker.lock();
+    s.m_generation++;
+    std::unordered_map<std::string_view, file_entry *>::iterator it = s.m_table.find(path);
+    if (it != s.m_table.end())
+    {
+        remove(s, it->second);
+    }
+    remove_missing(s, path);
+    s.m_locker.unlock();
+    // 预压缩文件变了，原文件记住的查找结果也要失效
+    for (int i = 0; i < ENCODING_NUM; i++)
+    {
+        std::string_view suffix = ENCODINGS[i].m_suffix;
+        if (path.size() > suffix.size() && path.substr(path.size() - suffix.size()) == suffix)
+        {
+            invalidate(path.substr(0, path.size() - suffix.size()));
+        }
+    }
+}
+
+void file_cache::clear()
+{
+    for (int i = 0; i < FILE_CACHE_SHARD_NUM; i++)
+    {
+        shard &s = m_shards[i];
+        s.m_locker.lock();
+        s.m_generation++;
+        while (!s.m_lru.empty())
+        {
+            remove(s, s.m_lru.back());
+        }
+        s.m_locker.unlock();
+    }
+}
+
+/**
+ * @brief 路径是否最近确认过不存在。过期的顺便去掉。需要持有分片的锁
+ *
+ * @param s
+ * @param path
+ * @return true 不存在，不需要stat
+ */
+bool file_cache::find_missing(shard &s, std::string_view path)
+{
+    std::unordered_map<std::string_view, std::list<missing_entry>::iterator>::iterator it = s.m_missing.find(path);
+    if (it == s.m_missing.end())
+    {
+        return false;
+    }
+    if (it->second->m_expire > time(NULL))
+    {
+        return true;
+    }
+    // 键指向链表中的字符串，先从表中去掉
+    std::list<missing_entry>::iterator entry = it->second;
+    s.m_missing.erase(it);
+    s.m_missing_order.erase(entry);
+    return false;
+}
+
+/**
+ * @brief 记住不存在的路径，超过上限时去掉最早的。需要持有分片的锁
+ *
+ * @param s
+ * @param path
+ */
+void file_cache::add_missing(shard &s, std::string_view path)
+{
+    if (s.m_missing.find(path) != s.m_missing.end())
+    {
+        return;
+    }
+    while (s.m_missing.size() >= m_max_missing && !s.m_missing_order.empty())
+    {
+        s.m_missing.erase(s.m_missing_order.front().m_path);
+        s.m_missing_order.pop_front();
+    }
+    s.m_missing_order.push_back({std::string(path), time(NULL) + FILE_CACHE_MISSING_TTL});
+    std::list<missing_entry>::iterator it = std::prev(s.m_missing_order.end());
+    s.m_missing[it->m_path] = it;
+}
+
+/**
+ * @brief 路径被创建了。需要持有分片的锁
+ *
+ * @param s
+ * @param path
+ */
+void file_cache::remove_missing(shard &s, std::string_view path)
+{
+    std::unordered_map<std::string_view, std::list<missing_entry>::iterator>::iterator it = s.m_missing.find(path);
+    if (it != s.m_missing.end())
+    {
+        std::list<missing_entry>::iterator entry = it->second;
+        s.m_missing.erase(it);
+        s.m_missing_order.erase(entry);
+    }
+}
+
+void file_cache::clear_missing()
+{
+    for (int i = 0; i < FILE_CACHE_SHARD_NUM; i++)
+    {
+        shard &s = m_shards[i];
+        s.m_locker.lock();
+        // 查找期间的stat结果也不再可信
+        s.m_generation++;
+        s.m_missing.clear();
+        s.m_missing_order.clear();
+        s.m_locker.unlock();
+    }
+}
@@ -0,0 +1,173 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include "http_conn.h"
+#include "locker.h"
+#include "arena.h"
+#include "http_response.h"
+#include <pthread.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// 缓存分片数(2的幂)，不同分片的查找互不竞争
+#define FILE_CACHE_SHARD_NUM 16
+// 最多缓存的文件数，每个文件占一个fd
+#define FILE_CACHE_MAX_ENTRIES 1024
+// 缓存中文件映射的总字节数上限
+#define FILE_CACHE_MAX_BYTES (256 * 1024 * 1024)
+// 超过这个大小的文件不在缓存中映射，由连接自己映射
+#define FILE_CACHE_MAX_MAP_SIZE (16 * 1024 * 1024)
+// 不超过这个大小的文件缓存完整的响应
+#define FILE_CACHE_RESPONSE_FILE_SIZE (16 * 1024)
+// 缓存的响应的总字节数上限
+#define FILE_CACHE_MAX_RESPONSE_BYTES (64 * 1024 * 1024)
+// 记住的不存在的路径数上限，扫描器请求大量不存在的路径时按先进先出淘汰
+#define FILE_CACHE_MAX_MISSING 4096
+// 不存在的路径记住的秒数。父目录没有被监视时收不到创建事件，靠它兜底
+#define FILE_CACHE_MISSING_TTL 10
+// ETag的最大长度，三个64位十六进制数加引号和分隔符
+#define FILE_ETAG_SIZE 56
+
+/**
+ * @brief 缓存的文件。缓存和正在发送它的连接各持有一个引用，
+ * 失效或被淘汰后等最后一个连接发送完才关闭fd、解除映射。
+ */
+struct file_entry
+{
+    std::string m_path; // 相对根目录的路径，以/开头，也是缓存的键
+    int m_fd;
+    struct stat m_stat;
+    // 由inode、大小、修改时间生成的验证器，创建时格式化好
+    char m_etag[FILE_ETAG_SIZE];
+    int m_etag_len;
+    char m_last_modified[HTTP_DATE_SIZE];
+    char *m_addr; // 文件映射，第一次需要时才映射
+    // 序列化好的响应(状态行、和请求无关的响应头、文件内容)，第一次需要时生成
+    char *m_response;
+    size_t m_response_len;
+    size_t m_response_head_len; // 其中状态行和响应头的长度，每个响应不同的头插在这之后
+    // 预压缩的兄弟文件(.br、.gz)，持有引用，第一次协商时查找，没有时为NULL
+    file_entry *m_variants[ENCODING_NUM];
+    unsigned m_variants_checked; // 第i位表示m_variants[i]已经查找过
+    std::atomic<int> m_ref;
+    bool m_cached; // 是否还在缓存中
+    std::list<file_entry *>::iterator m_lru;
+};
+
+// 把解码后的url转换成相对根目录的路径，path至少url.size() + 2字节，..超出根目录时返回-1
+int normalize_url(std::string_view url, char *path);
+
+/**
+ * @brief 进程内共享的打开文件缓存
+ * 按规范化后的路径缓存fd、stat和文件映射，命中时不需要任何系统调用。
+ * 每个分片一把锁和一个LRU链表，按文件数和映射字节数淘汰。
+ * 文件所在目录用inotify监视，文件被修改、删除、改名后由后台线程把它从缓存中去掉。
+ * 不存在的路径也记住一段时间，重复的404不需要stat，路径被创建时同样由inotify事件去掉。
+ */
+class file_cache
+{
+public:
+    /**
+     * @param root 网站根目录
+     * @param max_entries 最多缓存的文件数
+     * @param max_bytes 映射的总字节数上限
+     * @param response_file_size 不超过这个大小的文件缓存完整响应，0表示不缓存响应
+     * @param max_response_bytes 缓存的响应的总字节数上限
+     */
+    file_cache(const std::string &root, int max_entries = FILE_CACHE_MAX_ENTRIES, size_t max_bytes = FILE_CACHE_MAX_BYTES,
+               size_t response_file_size = FILE_CACHE_RESPONSE_FILE_SIZE, size_t max_response_bytes = FILE_CACHE_MAX_RESPONSE_BYTES);
+    ~file_cache();
+    // 创建inotify并启动监视线程，失败时不缓存，每次请求直接打开文件
+    bool start();
+    // 停止监视线程
+    void stop();
+
+    // 查找url对应的文件，成功时返回FILE_REQUEST，entry用完后需要release，是目录时返回DIR_REQUEST。规范化的路径从mem分配
+    HTTP_CODE acquire(std::string_view url, file_entry *&entry, arena &mem);
+    // 打开url对应的目录，失败时返回-1，dir_url是规范化后相对根目录的路径
+    int open_dir(std::string_view url, arena &mem, std::string_view &dir_url);
+    void release(file_entry *entry);
+    // 文件的预压缩版本(路径加.br、.gz)，用完后需要release，没有时返回NULL
+    file_entry *get_variant(file_entry *entry, CONTENT_ENCODING encoding, arena &mem);
+    // 文件的共享映射，文件太大不缓存映射时返回NULL
+    char *get_map(file_entry *entry);
+    // 文件是否足够小，可以缓存完整响应
+    bool can_cache_response(const file_entry *entry) const;
+    // 缓存的响应，没有时返回NULL，调用者生成响应头后用set_response放入。head_len是其中响应头的长度
+    const char *get_response(file_entry *entry, size_t &len, size_t &head_len);
+    const char *set_response(file_entry *entry, std::string_view header, size_t &len, size_t &head_len);
+    // 打印命中统计
+    void print_stats();
+
+private:
+    /// @brief 不存在的路径
+    struct missing_entry
+    {
+        std::string m_path;
+        time_t m_expire; // 过期时间
+    };
+
+    struct shard
+    {
+        locker m_locker;
+        // 键指向file_entry::m_path，查找时不需要构造std::string
+        std::unordered_map<std::string_view, file_entry *> m_table;
+        // 最近使用的在前面
+        std::list<file_entry *> m_lru;
+        // 不存在的路径，键指向missing_entry::m_path，新的在后面
+        std::unordered_map<std::string_view, std::list<missing_entry>::iterator> m_missing;
+        std::list<missing_entry> m_missing_order;
+        size_t m_bytes;
+        size_t m_response_bytes;
+        // 命中统计，在锁内累加
+        long m_hits;
+        long m_misses;
+        long m_response_hits;
+        long m_response_misses;
+        long m_missing_hits;
+        // 每次有文件失效时加一，未命中时用来判断打开文件期间有没有失效
+        unsigned m_generation;
+    };
+
+    std::string m_root;
+    int m_max_entries;
+    size_t m_max_missing;
+    size_t m_max_bytes;
+    size_t m_response_file_size;
+    size_t m_max_response_bytes;
+    shard m_shards[FILE_CACHE_SHARD_NUM];
+    bool m_enabled;
+    int m_root_fd; // 根目录，所有文件相对它打开
+    std::atomic<bool> m_use_openat2; // 内核不支持时退回openat
+
+    int m_inotify_fd;
+    // 通知监视线程退出
+    int m_wakeup_fd;
+    pthread_t m_thread;
+    bool m_is_started;
+    // 已经监视的目录，相对根目录的路径
+    locker m_watch_locker;
+    std::unordered_map<int, std::string> m_watch_dirs;
+    std::unordered_map<std::string, int> m_dir_watches;
+
+private:
+    static void *worker(void *arg);
+    void run();
+    shard &get_shard(std::string_view path);
+    bool watch_dir(std::string_view path);
+    int open_beneath(const char *path, int flags);
+    void evict(shard &s);
+    void remove(shard &s, file_entry *entry);
+    void invalidate(std::string_view path);
+    void clear();
+    bool find_missing(shard &s, std::string_view path);
+    void add_missing(shard &s, std::string_view path);
+    void remove_missing(shard &s, std::string_view path);
+    void clear_missing();
+};
+
+#endif // !FILE_CACHE_H
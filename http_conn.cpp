@@ -1,4 +1,12 @@
 #include "http_conn.h"
+#include "http_scan.h"
+#include "file_cache.h"
+#include "compress_cache.h"
+#include "dir_listing.h"
+#include "http_response.h"
+#include "conn_table.h"
+#include "bundle.h"
+#include "prefetcher.h"
 /**
  * @brief 设置文件描述符非阻塞
  *
@@ -15,11 +23,12 @@ void setnonblocking(int fd)
  *
  * @param epoll_fd
  * @param sock_fd
+ * @param data 事件带回的数据，连接是句柄，其他fd是fd本身
  */
-void epoll_add(int epoll_fd, int sock_fd, bool one_shot)
+void epoll_add(int epoll_fd, int sock_fd, uint64_t data, bool one_shot)
 {
     struct epoll_event epev;
-    epev.data.fd = sock_fd;
+    epev.data.u64 = data;
     epev.events = EPOLLHUP | EPOLLIN;
 
     if (one_shot)
@@ -40,7 +49,7 @@ void epoll_add(int epoll_fd, int sock_fd, bool one_shot)
  */
 void epoll_remove(int epoll_fd, int sock_fd)
 {
-    epoll_ctl(sock_fd, EPOLL_CTL_DEL, sock_fd, NULL);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sock_fd, NULL);
     close(sock_fd);
 }
 
@@ -49,32 +58,47 @@ void epoll_remove(int epoll_fd, int sock_fd)
  *
  * @param epoll_fd
  * @param sock_fd
- * @param epev
+ * @param data 连接的句柄
+ * @param ev
  */
-void epoll_modify(int epoll_fd, int sock_fd, int ev)
+void epoll_modify(int epoll_fd, int sock_fd, uint64_t data, int ev)
 {
     epoll_event epev;
-    epev.data.fd = sock_fd;
+    epev.data.u64 = data;
     epev.events = EPOLLONESHOT | ev | EPOLLRDHUP;
     epoll_ctl(epoll_fd, EPOLL_CTL_MOD, sock_fd, &epev);
 }
+http_conn::http_conn() : m_read_buf(NULL), m_read_buf_size(0), m_read_index(0), m_body_fd(-1)
+{
+}
+
 /**
  * @brief
  *
  * @param sockfd
  * @param sockaddr
+ * @param epoll_fd 负责该连接的事件循环的epoll，io_uring连接为-1
+ * @param handle 连接表分配的句柄
  */
-void http_conn::init(int sockfd, struct sockaddr_in sockaddr)
+void http_conn::init(int sockfd, struct sockaddr_in sockaddr, int epoll_fd, conn_handle handle, prefetch_done_queue *prefetch_done)
 {
     this->m_sockaddr = sockaddr;
     this->m_sockfd = sockfd;
+    this->m_epoll_fd = epoll_fd;
+    this->m_handle = handle;
+    this->m_prefetch_done = prefetch_done;
+    // 定时器跟随连接，保持连接时处理下一个请求不会重置
+    this->m_timer = NULL;
     http_conn::m_user_num++;
 
     // 设置端口复用
     int opt = 1;
     setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
-    // 将新的连接放到epoll里面
-    epoll_add(m_epoll_fd, sockfd, true);
+    // 将新的连接放到epoll里面，io_uring连接没有epoll
+    if (m_epoll_fd != -1)
+    {
+        epoll_add(m_epoll_fd, sockfd, m_handle, true);
+    }
 
     init();
 }
@@ -85,51 +109,133 @@ void http_conn::init(int sockfd, struct sockaddr_in sockaddr)
  */
 void http_conn::init()
 {
-    // printf("%s : line = %d\n", __FUNCTION__, __LINE__);
-    m_check_state = CHECK_STATE::CHECK_STATE_REQUESTLINE;
+    m_request_start = 0;
     m_checked_index = 0;
     m_start_line = 0;
-    m_read_index = 0;
-    bzero(m_read_buf, READ_BUFFER_SIZE);
-    bzero(m_write_buf, WRITE_BUFFER_SIZE);
-    m_url = "";
-    m_version = "";
-    m_response = "";
-    m_content = "";
+    free_buffer();
+    m_arena.reset();
+    m_response = NULL;
+    m_response_len = 0;
+    next_request();
+    m_iv_count = 0;
+    m_iv_mapped = 0;
+    m_prefetch_failed = false;
+    m_bytes_to_send = 0;
+    m_queued_num = 0;
+    m_keep_alive = false;
+    m_file = NULL;
+    m_file_size = 0;
+    m_vary = false;
+    m_mtime = 0;
+    m_full_size = 0;
+    m_encoding = ENCODING_IDENTITY;
+    m_compressed = NULL;
+    m_file_addr = NULL;
+    m_file_mapped = false;
+    m_file_map_len = 0;
+    m_file_map_offset = 0;
+    m_cached_response = NULL;
+    m_cached_response_len = 0;
+    m_cached_head_len = 0;
+    m_file_fd = -1;
+    m_file_offset = 0;
+    m_file_remain = 0;
+    m_chunk_source = NULL;
+    m_chunk_buf = NULL;
+    m_chunk_framing = false;
+    m_chunk_end = false;
+}
+
+/**
+ * @brief 上一个请求的响应已经生成，清空解析状态。读缓冲区中后面的数据属于下一个请求，保留不动
+ *
+ */
+void http_conn::next_request()
+{
+    m_check_state = CHECK_STATE::CHECK_STATE_REQUESTLINE;
+    m_request_start = m_checked_index;
+    m_url = std::string_view();
+    m_version = std::string_view();
+    m_content = std::string_view();
+    if (m_body_fd != -1)
+    {
+        close(m_body_fd);
+        m_body_fd = -1;
+    }
+    m_body_start = 0;
+    m_body_received = 0;
+    m_chunked = false;
+    m_chunk_state = CHUNK_STATE_SIZE;
+    m_chunk_remain = 0;
+    m_body_len = 0;
+    for (int i = 0; i < HEADER_KNOWN_NUM; i++)
+    {
+        m_known_headers[i] = std::string_view();
+    }
+    m_header_count = 0;
     m_content_length = 0;
     m_method = METHOD::GET;
     m_linger = false;
-    m_iv_count = 0;
-    m_timer = NULL;
-    // printf("%s : line = %d\n", __FUNCTION__, __LINE__);
+    m_sendfile = false;
+    m_range_num = 0;
 }
 
 void http_conn::close_conn()
 {
     int fd = this->m_sockfd;
-    epoll_remove(http_conn::m_epoll_fd, this->m_sockfd);
-    close(this->m_sockfd);
+    if (m_epoll_fd == -1)
+    {
+        // io_uring连接：只关闭读写，等该fd上的请求全部完成后再由uring_loop关闭fd，避免fd被复用
+        shutdown(fd, SHUT_RDWR);
+        return;
+    }
+    unmap();
+    free_buffer();
+    m_arena.reset();
+    if (m_body_fd != -1)
+    {
+        close(m_body_fd);
+        m_body_fd = -1;
+    }
+    // epoll_remove会关闭fd，不能再close一次，否则可能关掉其他事件循环刚accept的同号fd
+    epoll_remove(m_epoll_fd, this->m_sockfd);
     // m_sockfd = -1;
     http_conn::m_user_num--;
-    printf("%s close fd = %d\n", __FUNCTION__, fd);
+    // 最后归还槽位，之后这个对象可能马上被其他事件循环复用
+    conns->free(this);
 }
 // 读数据
 bool http_conn::read()
 {
-    // printf("%s : line = %d\n", __FUNCTION__, __LINE__);
-    if (m_read_index >= READ_BUFFER_SIZE)
+    if (m_read_buf == NULL)
     {
-        return false;
+        m_read_buf = buffer_pool::alloc();
+        m_read_buf_size = READ_BUFFER_SIZE;
+    }
+    if (m_read_index >= m_read_buf_size)
+    {
+        // 前面处理完的流水线请求先腾出位置，还不够再扩大
+        compact_read_buf();
+        if (m_read_index >= m_read_buf_size && !grow_read_buf())
+        {
+            // 请求头太大
+            return false;
+        }
     }
-    while (1)
+    // 缓冲区满了先返回，解析完(请求体写出去)之后再继续读
+    while (m_read_index < m_read_buf_size)
     {
         int len;
 
-        len = recv(m_sockfd, m_read_buf + m_read_index, READ_BUFFER_SIZE - m_read_index, 0);
-        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        len = recv(m_sockfd, m_read_buf + m_read_index, m_read_buf_size - m_read_index, 0);
+        if (len == -1)
         {
-            // 读完数据了
-            break;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                // 读完数据了
+                break;
+            }
+            return false;
         }
         else if (len == 0)
         {
@@ -138,51 +244,233 @@ bool http_conn::read()
         }
         m_read_index += len;
     }
-    // printf("%s : line = %d\n", __FUNCTION__, __LINE__);
-
-    // printf("recv data:\n%s\n", m_read_buf);
-
+    if (m_read_index == 0)
+    {
+        // 没有读到数据，不占着缓冲区
+        free_buffer();
+    }
     return true;
 }
 // 写数据
 bool http_conn::write()
 {
-    int temp = 0;
-    int send_len = 0, len = m_response.length();
-    if (len == 0)
+    if (m_bytes_to_send == 0 && m_file_remain == 0)
     {
         // 没有要写回的数据
-        epoll_modify(m_epoll_fd, m_sockfd, EPOLLIN);
-        init();
+        epoll_modify(m_epoll_fd, m_sockfd, m_handle, EPOLLIN);
         return true;
     }
 
-    while (true)
+    // 一批流水线请求的响应合并成一次sendmsg。先发响应头(和映射的文件)，后面还有sendfile时带上MSG_MORE，让头和文件内容合并成满的报文
+    do
     {
-        temp = writev(m_sockfd, m_iv, m_iv_count);
-        if (temp == -1)
+        while (m_bytes_to_send > 0)
         {
-            if (errno == EAGAIN)
+            if (prefetch_iov())
             {
-                epoll_modify(m_epoll_fd, m_sockfd, EPOLLOUT);
+                // 预读完成后由事件循环接着发送
                 return true;
             }
-            unmap();
-            return false;
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = m_iv;
+            msg.msg_iovlen = m_iv_count;
+            ssize_t temp = sendmsg(m_sockfd, &msg, MSG_NOSIGNAL | (m_file_remain > 0 ? MSG_MORE : 0));
+            if (temp == -1)
+            {
+                if (errno == EAGAIN)
+                {
+                    epoll_modify(m_epoll_fd, m_sockfd, m_handle, EPOLLOUT);
+                    return true;
+                }
+                unmap();
+                return false;
+            }
+            consume_iov(temp);
         }
-        send_len += temp;
-        if (send_len >= len)
+
+        // 文件内容由内核直接从页缓存发送，偏移由sendfile推进，EPOLLOUT唤醒后从这里继续
+        while (m_file_remain > 0)
         {
-            unmap();
-            epoll_modify(m_epoll_fd, m_sockfd, EPOLLIN);
-            if (m_linger)
+            if (prefetch_file())
             {
-                init();
                 return true;
             }
+            ssize_t temp = sendfile(m_sockfd, m_file_fd, &m_file_offset, m_file_remain);
+            if (temp == -1)
+            {
+                if (errno == EAGAIN)
+                {
+                    epoll_modify(m_epoll_fd, m_sockfd, m_handle, EPOLLOUT);
+                    return true;
+                }
+                unmap();
+                return false;
+            }
+            if (temp == 0)
+            {
+                // 文件被截断了
+                unmap();
+                return false;
+            }
+            m_file_remain -= temp;
+        }
+        // 流式响应发完一块再取下一块
+    } while (next_chunk());
+
+    if (!finish_write())
+    {
+        return false;
+    }
+    // 缓冲区中还有下一个请求的数据时由事件循环接着处理，不等EPOLLIN
+    if (!has_pending_input())
+    {
+        epoll_modify(m_epoll_fd, m_sockfd, m_handle, EPOLLIN);
+    }
+    return true;
+}
+
+/**
+ * @brief 发送前检查接下来PREFETCH_WINDOW字节中文件映射的数据是否在页缓存中，
+ * 第一段不在的交给预读线程，事件循环线程不等磁盘
+ *
+ * @return true 已经交给预读线程，这次不发送
+ */
+bool http_conn::prefetch_iov()
+{
+    if (m_prefetcher == NULL || m_prefetch_done == NULL || m_prefetch_failed || m_iv_mapped == 0)
+    {
+        return false;
+    }
+    size_t window = PREFETCH_WINDOW;
+    for (int i = 0; i < m_iv_count && window > 0; i++)
+    {
+        size_t len = std::min(m_iv[i].iov_len, window);
+        window -= len;
+        if ((m_iv_mapped & ((uint64_t)1 << i)) && !m_prefetcher->resident(m_iv[i].iov_base, len))
+        {
+            return m_prefetcher->submit(m_prefetch_done, m_handle, m_iv[i].iov_base, len);
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief 和prefetch_iov一样，检查接下来要sendfile的部分
+ *
+ * @return true 已经交给预读线程
+ */
+bool http_conn::prefetch_file()
+{
+    if (m_prefetcher == NULL || m_prefetch_done == NULL || m_prefetch_failed)
+    {
+        return false;
+    }
+    size_t len = std::min(m_file_remain, (size_t)PREFETCH_WINDOW);
+    return !m_prefetcher->resident(m_file_fd, m_file_offset, len) &&
+           m_prefetcher->submit(m_prefetch_done, m_handle, m_file_fd, m_file_offset, len);
+}
+
+/**
+ * @brief 跳过m_iv中已经发送的len字节
+ *
+ * @param len
+ */
+void http_conn::consume_iov(size_t len)
+{
+    m_bytes_to_send -= len;
+    int i = 0;
+    while (i < m_iv_count && len >= m_iv[i].iov_len)
+    {
+        len -= m_iv[i].iov_len;
+        i++;
+    }
+    if (i < m_iv_count)
+    {
+        m_iv[i].iov_base = (char *)m_iv[i].iov_base + len;
+        m_iv[i].iov_len -= len;
+    }
+    // 去掉发送完的部分
+    for (int j = i; j < m_iv_count; j++)
+    {
+        m_iv[j - i] = m_iv[j];
+    }
+    m_iv_count -= i;
+    m_iv_mapped >>= i;
+}
+
+/**
+ * @brief 追加收到的数据到读缓冲区
+ *
+ * @param data
+ * @param len
+ * @return false 缓冲区已满
+ */
+bool http_conn::append_read(const char *data, int len)
+{
+    if (m_read_buf == NULL)
+    {
+        m_read_buf = buffer_pool::alloc();
+        m_read_buf_size = READ_BUFFER_SIZE;
+    }
+    if (len > m_read_buf_size - m_read_index)
+    {
+        compact_read_buf();
+    }
+    while (len > m_read_buf_size - m_read_index)
+    {
+        if (!grow_read_buf())
+        {
             return false;
         }
     }
+    memcpy(m_read_buf + m_read_index, data, len);
+    m_read_index += len;
+    return true;
+}
+
+const struct iovec *http_conn::get_iov(int &count)
+{
+    count = m_iv_count;
+    return m_iv;
+}
+
+/**
+ * @brief 响应发送完毕，释放文件映射和临时数据，保持连接时把没处理的数据挪到缓冲区开头
+ *
+ * @return true 保持连接
+ * @return false 需要关闭连接
+ */
+bool http_conn::finish_write()
+{
+    unmap();
+    m_iv_count = 0;
+    m_iv_mapped = 0;
+    m_prefetch_failed = false;
+    m_bytes_to_send = 0;
+    if (!m_keep_alive)
+    {
+        return false;
+    }
+    // 解析到一半的请求不使用m_arena
+    m_arena.reset();
+    compact_read_buf();
+    if (m_read_index == 0)
+    {
+        // 保持连接空闲时不占用缓冲区
+        free_buffer();
+    }
+    return true;
+}
+
+/**
+ * @brief 响应已经发送完，读缓冲区中还有没检查过的数据，可能是已经收到的下一个流水线请求
+ *
+ * @return true 需要再调用process_requests
+ */
+bool http_conn::has_pending_input()
+{
+    return m_bytes_to_send == 0 && m_file_remain == 0 && m_chunk_source == NULL && m_checked_index < m_read_index;
 }
 
 /**
@@ -191,23 +479,53 @@ bool http_conn::write()
  */
 void http_conn::process()
 {
-    printf("解析http数据包\n");
-    // 解析HTTP请求
-    HTTP_CODE ret = process_read();
-    if (ret == HTTP_CODE::NO_REQUEST)
+    if (!process_requests())
+    {
+        close_conn();
+        return;
+    }
+    if (m_bytes_to_send == 0 && m_file_remain == 0)
     {
-        epoll_modify(m_epoll_fd, m_sockfd, EPOLLIN);
+        // 请求不完整
+        epoll_modify(m_epoll_fd, m_sockfd, m_handle, EPOLLIN);
         return;
     }
-    if (!process_write(ret))
+    epoll_modify(m_epoll_fd, m_sockfd, m_handle, EPOLLOUT);
+}
+
+/**
+ * @brief 依次解析读缓冲区中的请求，响应追加到m_iv中一起发送。
+ * 遇到不完整的请求、不保持连接的请求、用sendfile发送的文件、流式响应或者攒满MAX_PIPELINE_NUM个(m_iv放不下)时停下，
+ * 剩下的数据等这一批发送完再处理，保证响应的顺序
+ *
+ * @return false 生成响应失败，需要关闭连接
+ */
+bool http_conn::process_requests()
+{
+    while (m_queued_num < MAX_PIPELINE_NUM && m_iv_count + MAX_RESPONSE_IOV <= MAX_IOV_NUM && m_file_remain == 0 && m_chunk_source == NULL)
     {
-        close_conn();
+        HTTP_CODE ret = process_read();
+        if (ret == HTTP_CODE::NO_REQUEST)
+        {
+            break;
+        }
+        // 请求格式错误时找不到下一个请求的开头，回应后关闭连接
+        m_keep_alive = m_linger && ret != HTTP_CODE::BAD_REQUEST && ret != HTTP_CODE::INTERNAL_ERROR;
+        if (!process_write(ret))
+        {
+            return false;
+        }
+        next_request();
+        if (!m_keep_alive)
+        {
+            break;
+        }
     }
-    epoll_modify(m_epoll_fd, m_sockfd, EPOLLOUT);
+    return true;
 }
 
 /**
- * @brief 解析HTTP请求,主状态机
+ * @brief 解析HTTP请求,主状态机。数据不完整时返回NO_REQUEST，收到更多数据后从断点继续
  *
  * @return HTTP_CODE
  */
@@ -216,17 +534,44 @@ HTTP_CODE http_conn::process_read()
     LINE_STATE line_state = LINE_STATE::LINE_OK;
     HTTP_CODE ret = HTTP_CODE::NO_REQUEST;
     char *text = {0};
-    while ((line_state = parse_line()) == LINE_OK ||
-           (m_check_state == CHECK_STATE_CONTENT && line_state == LINE_OK))
+    while (true)
     {
+        if (m_check_state == CHECK_STATE_CONTENT)
+        {
+            // 请求体不按行解析，大的请求体边收边写入临时文件
+            if (m_chunked)
+            {
+                ret = parse_chunked();
+            }
+            else
+            {
+                ret = m_body_fd != -1 ? write_body() : parse_content(m_read_buf + m_checked_index);
+            }
+            if (ret == GET_REQUEST)
+            {
+                return do_request();
+            }
+            return ret;
+        }
+        line_state = parse_line();
+        if (line_state == LINE_BAD)
+        {
+            return BAD_REQUEST;
+        }
+        if (line_state == LINE_OPEN)
+        {
+            return NO_REQUEST;
+        }
 
         text = get_line();
+        // 去掉行尾的\r\n
+        int len = m_checked_index - m_start_line - 2;
         m_start_line = m_checked_index;
         switch (m_check_state)
         {
         case CHECK_STATE_REQUESTLINE:
         {
-            ret = parse_request_line(text);
+            ret = parse_request_line(text, len);
             if (ret == HTTP_CODE::BAD_REQUEST)
             {
                 return ret;
@@ -236,8 +581,8 @@ HTTP_CODE http_conn::process_read()
         }
         case CHECK_STATE_HEADER:
         {
-            ret = parse_header(text);
-            if (ret == HTTP_CODE::BAD_REQUEST)
+            ret = parse_header(text, len);
+            if (ret == HTTP_CODE::BAD_REQUEST || ret == HTTP_CODE::INTERNAL_ERROR)
             {
                 return ret;
             }
@@ -247,197 +592,1583 @@ HTTP_CODE http_conn::process_read()
             }
             break;
         }
-        case CHECK_STATE_CONTENT:
-        {
-            ret = parse_content(text);
-            if (ret == GET_REQUEST)
-            {
-                return do_request();
-            }
-            line_state = LINE_OPEN;
+        default:
             break;
         }
-        }
     }
-    return INTERNAL_ERROR;
 }
 
 bool http_conn::process_write(HTTP_CODE http_code)
 {
-
-    std::string code = std::to_string(http_code);
-    std::map<std::string, std::string>::const_iterator it = HTTP_STATUS_CODE.find(code);
-    // 生成响应
-    if (it != HTTP_STATUS_CODE.end())
+    if (http_code == HTTP_CODE::FILE_REQUEST && m_cached_response != NULL)
+    {
+        // 缓存的状态行、响应头和文件内容不用生成，中间插入每个响应不同的Date和Connection。
+        // 文件缓存的响应在堆上，打包文件的响应在映射中
+        add_iov(m_cached_response, m_cached_head_len, m_bundle != NULL);
+        append_tail();
+        add_iov(m_response, m_response_len);
+        add_iov(m_cached_response + m_cached_head_len, m_cached_response_len - m_cached_head_len, m_bundle != NULL);
+    }
+    else if (http_code == HTTP_CODE::FILE_REQUEST && m_chunk_source != NULL)
     {
-        m_response += m_version + " " + code + it->second;
-        if (http_code == HTTP_CODE::FILE_REQUEST)
+        // 流式响应：响应头和第一块一起发出去，后面的块发送完一块取一块
+        append_response(status_line(http_code));
+        append_response("Content-Type: text/html; charset=utf-8\r\n");
+        if (m_chunk_framing)
         {
-            m_iv[0].iov_base = m_response.data();
-            m_iv[0].iov_len = m_response.length() + 1;
-            m_iv[1].iov_base = m_file_addr;
-            m_iv[1].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
+            append_response("Transfer-Encoding: chunked\r\n");
         }
-        return true;
+        append_tail();
+        add_iov(m_response, m_response_len);
+        append_chunk();
     }
-    return false;
+    else if (http_code == HTTP_CODE::NOT_MODIFIED)
+    {
+        // 只有验证器，没有响应体
+        append_response(status_line(http_code));
+        append_validators();
+        append_tail();
+        add_iov(m_response, m_response_len);
+    }
+    else if (http_code == HTTP_CODE::FILE_REQUEST)
+    {
+        append_file_head();
+        append_tail();
+        add_iov(m_response, m_response_len);
+        if (m_file_addr != NULL)
+        {
+            add_iov(m_file_addr, m_file_size, m_compressed == NULL);
+        }
+    }
+    else if (http_code == HTTP_CODE::PARTIAL_CONTENT && m_range_num > 1)
+    {
+        append_ranges();
+    }
+    else if (http_code == HTTP_CODE::PARTIAL_CONTENT)
+    {
+        const byte_range &range = m_ranges[0];
+        append_response(status_line(http_code));
+        append_response(m_content_type);
+        append_content_range(range.m_start, range.m_len);
+        append_content_length(range.m_len);
+        append_validators();
+        append_tail();
+        add_iov(m_response, m_response_len);
+        // 用sendfile时m_file_addr为NULL
+        if (m_file_addr != NULL)
+        {
+            add_iov(m_file_addr + (range.m_start - m_file_map_offset), range.m_len, true);
+        }
+    }
+    else
+    {
+        // 出错响应的状态行、响应头和响应体都是编译期生成好的
+        std::string_view head = error_head(http_code);
+        if (head.empty())
+        {
+            return false;
+        }
+        append_response(head);
+        if (http_code == HTTP_CODE::RANGE_NOT_SATISFIABLE)
+        {
+            // 告诉客户端文件现在的大小
+            append_content_range(-1, 0);
+        }
+        append_tail();
+        append_response(error_body(http_code));
+        add_iov(m_response, m_response_len);
+    }
+    // 文件和映射等整批发送完再释放，响应头在m_arena中，下一个响应重新生成
+    m_queued[m_queued_num].m_file = m_file;
+    m_queued[m_queued_num].m_map = m_file_mapped ? m_file_addr : NULL;
+    m_queued[m_queued_num].m_map_len = m_file_map_len;
+    m_queued[m_queued_num].m_compressed = m_compressed;
+    m_queued_num++;
+    m_file = NULL;
+    m_compressed = NULL;
+    m_encoding = ENCODING_IDENTITY;
+    m_file_addr = NULL;
+    m_file_mapped = false;
+    m_file_map_len = 0;
+    m_file_map_offset = 0;
+    m_cached_response = NULL;
+    m_response = NULL;
+    m_response_len = 0;
+    return true;
 }
 
 /**
- * @brief  解析HTTP请求首行(从状态机)，获取请求方法、目标URL、HTTP版本
+ * @brief 在m_iv后面追加一段要发送的数据
  *
- * @param text
- * @return HTTP_CODE
+ * @param data
+ * @param len
+ * @param mapped 数据在文件映射中，发送前要检查是否在页缓存中
  */
-HTTP_CODE http_conn::parse_request_line(char *text)
+void http_conn::add_iov(const void *data, size_t len, bool mapped)
 {
-
-    std::regex pattern("([A-Z]*)\\s+(.*)\\s+(.*)");
-    std::string t = text;
-    std::smatch match;
-    std::regex_search(t, match, pattern);
-    if (match[1] == "GET")
+    if (mapped)
     {
-        m_method = METHOD::GET;
+        m_iv_mapped |= (uint64_t)1 << m_iv_count;
     }
-    else
+    m_iv[m_iv_count].iov_base = (void *)data;
+    m_iv[m_iv_count].iov_len = len;
+    m_iv_count++;
+    m_bytes_to_send += len;
+}
+
+/**
+ * @brief 在m_response后面追加文件响应的状态行、Content-Type、Content-Length和验证器，这部分和请求无关，可以缓存
+ *
+ */
+void http_conn::append_file_head()
+{
+    append_response(status_line(HTTP_CODE::FILE_REQUEST));
+    append_response(m_content_type);
+    if (m_encoding != ENCODING_IDENTITY)
     {
-        return BAD_REQUEST;
+        append_response(ENCODINGS[m_encoding].m_line);
     }
-    m_url = match[2].str();
-    m_version = match[3].str();
-    printf("method: %s,url: %s,version: %s\n", match[1].str().c_str(), m_url.c_str(), m_version.c_str());
-    m_check_state = CHECK_STATE_HEADER;
-    return NO_REQUEST;
+    append_content_length(m_file_size);
+    append_validators();
 }
 
 /**
- * @brief 解析HTTP请求头
+ * @brief 在m_response后面追加Content-Length
  *
- * @param text
- * @return HTTP_CODE
+ * @param len
  */
-HTTP_CODE http_conn::parse_header(char *text)
+void http_conn::append_content_length(uint64_t len)
 {
+    char line[64] = "Content-Length: ";
+    int n = strlen(line);
+    n += format_decimal(line + n, len);
+    line[n++] = '\r';
+    line[n++] = '\n';
+    append_response(std::string_view(line, n));
+}
 
-    std::string tx = text;
-    std::regex pattern("(.*):(.*)\\r\\n");
-    std::smatch match;
-    std::string::const_iterator citer = tx.cbegin();
-    // 匹配键值对，并将键值对存到m_headers里面
-    while (std::regex_search(citer, tx.cend(), match, pattern))
+/**
+ * @brief 在m_response后面追加Content-Range
+ *
+ * @param start 区间起点，-1表示没有满足的区间(416)
+ * @param len 区间长度
+ */
+void http_conn::append_content_range(off_t start, off_t len)
+{
+    char line[96] = "Content-Range: bytes ";
+    int n = strlen(line);
+    if (start < 0)
+    {
+        line[n++] = '*';
+    }
+    else
     {
-        m_headers[match[1]] = match[2];
-        text += match[1].length() + match[2].length() + 4;
-        tx = text;
-        citer = tx.cbegin();
+        n += format_decimal(line + n, start);
+        line[n++] = '-';
+        n += format_decimal(line + n, start + len - 1);
     }
-    if (m_headers["Connection"] == "keep-alive")
+    line[n++] = '/';
+    n += format_decimal(line + n, m_full_size);
+    line[n++] = '\r';
+    line[n++] = '\n';
+    append_response(std::string_view(line, n));
+}
+
+/**
+ * @brief 多个区间的multipart/byteranges响应。先在m_arena中生成每一部分的分隔符和头，
+ * 算出总长度后再生成响应头，文件内容直接指向映射，不复制
+ *
+ */
+void http_conn::append_ranges()
+{
+    size_t part_offset[MAX_RANGE_NUM + 1];
+    uint64_t body_len = 0;
+    std::string_view type = m_content_type;
+    for (int i = 0; i < m_range_num; i++)
     {
-        m_linger = true;
+        part_offset[i] = m_response_len;
+        append_response(i == 0 ? "--" MULTIPART_BOUNDARY "\r\n" : "\r\n--" MULTIPART_BOUNDARY "\r\n");
+        append_response(type);
+        append_content_range(m_ranges[i].m_start, m_ranges[i].m_len);
+        append_response("\r\n");
+        body_len += m_ranges[i].m_len;
     }
-    if (m_headers.find("Content-Length") != m_headers.end())
+    part_offset[m_range_num] = m_response_len;
+    append_response("\r\n--" MULTIPART_BOUNDARY "--\r\n");
+    body_len += m_response_len;
+    // 各部分的头已经生成完，m_response换成新的一块生成响应头
+    char *parts = m_response;
+    size_t parts_len = m_response_len;
+    m_response = NULL;
+    m_response_len = 0;
+
+    append_response(status_line(HTTP_CODE::PARTIAL_CONTENT));
+    append_response("Content-Type: multipart/byteranges; boundary=" MULTIPART_BOUNDARY "\r\n");
+    append_content_length(body_len);
+    append_validators();
+    append_tail();
+    add_iov(m_response, m_response_len);
+    for (int i = 0; i < m_range_num; i++)
     {
-        text += 4;
-        // 有请求体
-        m_content_length = std::stoi(m_headers["Content-Length"]);
-        m_check_state = CHECK_STATE_CONTENT;
-        return HTTP_CODE::NO_REQUEST;
+        add_iov(parts + part_offset[i], part_offset[i + 1] - part_offset[i]);
+        add_iov(m_file_addr + (m_ranges[i].m_start - m_file_map_offset), m_ranges[i].m_len, true);
     }
-    return HTTP_CODE::GET_REQUEST;
+    add_iov(parts + part_offset[m_range_num], parts_len - part_offset[m_range_num]);
 }
 
 /**
- * @brief 解析HTTP请求体
+ * @brief 在m_response后面追加ETag和Last-Modified，可以压缩的文件还有Vary，让中间的缓存按Accept-Encoding区分
  *
- * @param text
- * @return HTTP_CODE
  */
-HTTP_CODE http_conn::parse_content(char *text)
+void http_conn::append_validators()
 {
-    if (*(text + m_content_length) == '\0')
+    append_response("ETag: ");
+    append_response(m_etag);
+    append_response("\r\nLast-Modified: ");
+    append_response(m_last_modified);
+    append_response("\r\n");
+    if (m_vary)
     {
-        m_content = text;
-        return HTTP_CODE::GET_REQUEST;
+        append_response("Vary: Accept-Encoding\r\n");
     }
-    return NO_REQUEST;
 }
 
 /**
- * @brief  解析一行数据(从状态机)
+ * @brief 在m_response后面追加每个响应不同的Date、Connection和结束响应头的空行
  *
- * @return LINE_STATE
  */
-LINE_STATE http_conn::parse_line()
+void http_conn::append_tail()
 {
+    append_response(http_date::get());
+    append_response(m_keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+}
 
-    char temp;
-    while (m_checked_index < m_read_index)
+/**
+ * @brief 在响应头后面追加，空间从m_arena分配，一般原地扩大
+ *
+ * @param str
+ */
+void http_conn::append_response(std::string_view str)
+{
+    size_t old_size = m_response == NULL ? 0 : m_response_len + 1;
+    m_response = m_arena.grow(m_response, old_size, m_response_len + str.size() + 1);
+    memcpy(m_response + m_response_len, str.data(), str.size());
+    m_response_len += str.size();
+    m_response[m_response_len] = '\0';
+}
+
+/**
+ * @brief 跳过空格和制表符
+ *
+ * @param text
+ * @param end
+ * @return char* 第一个不是空白的位置
+ */
+static inline char *skip_space(char *text, char *end)
+{
+    while (text < end && (*text == ' ' || *text == '\t'))
     {
-        temp = m_read_buf[m_checked_index];
-        if (temp == '\r')
-        {
-            if (m_checked_index + 1 == m_read_index)
-            {
+        text++;
+    }
+    return text;
+}
+
+/**
+ * @brief 请求头名字是否是token(RFC 9110 5.6.2)：字母、数字和!#$%&'*+-.^_`|~
+ *
+ * @param name
+ * @return false 有空白或其他字符
+ */
+static inline bool is_token(std::string_view name)
+{
+    for (unsigned char c : name)
+    {
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+              (c != 0 && strchr("!#$%&'*+-.^_`|~", c) != NULL)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief 不区分大小写比较
+ *
+ * @param a
+ * @param b b需要是小写
+ * @return true 相等
+ */
+static inline bool equal_nocase(std::string_view a, std::string_view b)
+{
+    if (a.size() != b.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if ((a[i] | 0x20) != b[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief 十六进制数字的值
+ *
+ * @param c
+ * @return int 不是十六进制数字时返回-1
+ */
+static inline int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+/**
+ * @brief 原地解码路径中的%XX，解码后只会变短。
+ * %2F解码成/会改变路径的分段，%00会截断文件名，都拒绝
+ *
+ * @param path
+ * @param len
+ * @return int 解码后的长度，格式错误时返回-1
+ */
+static int decode_path(char *path, int len)
+{
+    int n = 0;
+    for (int i = 0; i < len; i++)
+    {
+        if (path[i] != '%')
+        {
+            path[n++] = path[i];
+            continue;
+        }
+        if (i + 2 >= len)
+        {
+            return -1;
+        }
+        int high = hex_value(path[i + 1]);
+        int low = hex_value(path[i + 2]);
+        if (high < 0 || low < 0)
+        {
+            return -1;
+        }
+        char c = high << 4 | low;
+        if (c == '\0' || c == '/')
+        {
+            return -1;
+        }
+        path[n++] = c;
+        i += 2;
+    }
+    return n;
+}
+
+/**
+ * @brief  解析HTTP请求首行(从状态机)，获取请求方法、目标URL、HTTP版本。不复制数据，结果指向读缓冲区
+ *
+ * @param text 一行数据
+ * @param len 不含\r\n的长度
+ * @return HTTP_CODE
+ */
+HTTP_CODE http_conn::parse_request_line(char *text, int len)
+{
+    char *end = text + len;
+    // 方法
+    char *p = (char *)scan_char(text, end, ' ');
+    if (p == end)
+    {
+        return BAD_REQUEST;
+    }
+    std::string_view method(text, p - text);
+    if (method == "GET")
+    {
+        m_method = METHOD::GET;
+    }
+    else if (method == "POST")
+    {
+        // 还没有处理请求体的程序，接收完请求体后和GET一样返回文件
+        m_method = METHOD::POST;
+    }
+    else
+    {
+        return BAD_REQUEST;
+    }
+
+    // URL
+    char *url = skip_space(p, end);
+    p = (char *)scan_char(url, end, ' ');
+    if (p == end || p == url)
+    {
+        return BAD_REQUEST;
+    }
+    m_url = std::string_view(url, p - url);
+    // 绝对形式的URL去掉协议和主机
+    if (m_url.compare(0, 7, "http://") == 0)
+    {
+        size_t slash = m_url.find('/', 7);
+        if (slash == std::string_view::npos)
+        {
+            return BAD_REQUEST;
+        }
+        m_url.remove_prefix(slash);
+    }
+    if (m_url[0] != '/')
+    {
+        return BAD_REQUEST;
+    }
+    // 先去掉查询参数和片段，再解码，解码出来的?和#是文件名的一部分
+    size_t query = m_url.find_first_of("?#");
+    if (query != std::string_view::npos)
+    {
+        m_url = m_url.substr(0, query);
+    }
+    int url_len = decode_path((char *)m_url.data(), m_url.size());
+    if (url_len < 0)
+    {
+        return BAD_REQUEST;
+    }
+    m_url = m_url.substr(0, url_len);
+
+    // 版本
+    char *version = skip_space(p, end);
+    m_version = std::string_view(version, end - version);
+    if (m_version.compare(0, 5, "HTTP/") != 0)
+    {
+        return BAD_REQUEST;
+    }
+    // HTTP/1.1默认保持连接，HTTP/1.0需要Connection: keep-alive
+    m_linger = m_version == "HTTP/1.1";
+    m_check_state = CHECK_STATE_HEADER;
+    return NO_REQUEST;
+}
+
+/**
+ * @brief 解析一行HTTP请求头，空行表示请求头结束
+ *
+ * @param text 一行数据
+ * @param len 不含\r\n的长度
+ * @return HTTP_CODE
+ */
+HTTP_CODE http_conn::parse_header(char *text, int len)
+{
+    if (len == 0)
+    {
+        if (m_chunked)
+        {
+            // 同时有Content-Length时两边对长度的理解可能不一样，可以用来夹带请求，拒绝
+            if (m_content_length > 0)
+            {
+                return BAD_REQUEST;
+            }
+            m_check_state = CHECK_STATE_CONTENT;
+            m_body_start = m_checked_index;
+            return HTTP_CODE::NO_REQUEST;
+        }
+        if (m_content_length > 0)
+        {
+            // 有请求体
+            m_check_state = CHECK_STATE_CONTENT;
+            m_body_start = m_checked_index;
+            if (m_content_length > BODY_INLINE_MAX_SIZE && !open_body_file())
+            {
+                return HTTP_CODE::INTERNAL_ERROR;
+            }
+            return HTTP_CODE::NO_REQUEST;
+        }
+        return HTTP_CODE::GET_REQUEST;
+    }
+
+    char *end = text + len;
+    char *colon = (char *)scan_char(text, end, ':');
+    if (colon == end || colon == text)
+    {
+        return BAD_REQUEST;
+    }
+    char *value = skip_space(colon + 1, end);
+    while (end > value && (end[-1] == ' ' || end[-1] == '\t'))
+    {
+        end--;
+    }
+    std::string_view name(text, colon - text);
+    std::string_view val(value, end - value);
+    // 名字和冒号之间的空白、以空白开头的折叠行(obs-fold)都要拒绝(RFC 9112 5.1、5.2)，
+    // 否则"Transfer-Encoding : chunked"会被当作不认识的请求头忽略，而前面宽松的代理认它，两边对请求边界的理解不一致
+    if (!is_token(name))
+    {
+        return BAD_REQUEST;
+    }
+    HEADER_ID id = find_header(name);
+    if (id == HEADER_UNKNOWN)
+    {
+        if (m_header_count < MAX_HEADER_NUM)
+        {
+            m_headers[m_header_count].m_name = name;
+            m_headers[m_header_count].m_value = val;
+            m_header_count++;
+        }
+        return HTTP_CODE::NO_REQUEST;
+    }
+    if (m_known_headers[id].data() != NULL)
+    {
+        // 重复的长度相关请求头可能用来夹带请求，其他的保留第一个
+        if (id == HEADER_CONTENT_LENGTH || id == HEADER_TRANSFER_ENCODING)
+        {
+            return BAD_REQUEST;
+        }
+        return HTTP_CODE::NO_REQUEST;
+    }
+    m_known_headers[id] = val;
+
+    switch (id)
+    {
+    case HEADER_CONNECTION:
+        if (equal_nocase(val, "keep-alive"))
+        {
+            m_linger = true;
+        }
+        else if (equal_nocase(val, "close"))
+        {
+            m_linger = false;
+        }
+        break;
+    case HEADER_CONTENT_LENGTH:
+    {
+        int length = 0;
+        for (size_t i = 0; i < val.size(); i++)
+        {
+            if (val[i] < '0' || val[i] > '9' || length > (INT32_MAX - 9) / 10)
+            {
+                return BAD_REQUEST;
+            }
+            length = length * 10 + (val[i] - '0');
+        }
+        if (length > MAX_BODY_SIZE)
+        {
+            return BAD_REQUEST;
+        }
+        m_content_length = length;
+        break;
+    }
+    case HEADER_TRANSFER_ENCODING:
+        // 只支持chunked
+        if (!equal_nocase(val, "chunked"))
+        {
+            return BAD_REQUEST;
+        }
+        m_chunked = true;
+        break;
+    default:
+        break;
+    }
+    return HTTP_CODE::NO_REQUEST;
+}
+
+/**
+ * @brief 查找请求头，已知的请求头直接取槽位，其他的顺序查找
+ *
+ * @param name 小写的请求头名字
+ * @return std::string_view 没有时为空
+ */
+std::string_view http_conn::get_header(std::string_view name)
+{
+    HEADER_ID id = find_header(name);
+    if (id != HEADER_UNKNOWN)
+    {
+        return m_known_headers[id];
+    }
+    for (int i = 0; i < m_header_count; i++)
+    {
+        if (equal_nocase(m_headers[i].m_name, name))
+        {
+            return m_headers[i].m_value;
+        }
+    }
+    return std::string_view();
+}
+
+/**
+ * @brief 解析HTTP请求体
+ *
+ * @param text 请求体的起始位置
+ * @return HTTP_CODE
+ */
+HTTP_CODE http_conn::parse_content(char *text)
+{
+    if (m_read_index - m_checked_index >= m_content_length)
+    {
+        m_content = std::string_view(text, m_content_length);
+        m_checked_index += m_content_length;
+        m_start_line = m_checked_index;
+        return HTTP_CODE::GET_REQUEST;
+    }
+    return NO_REQUEST;
+}
+
+/**
+ * @brief 把读缓冲区里的请求体写入临时文件，写出去的部分从缓冲区中去掉，缓冲区大小不随请求体增长
+ *
+ * @return HTTP_CODE 请求体全部收到时返回GET_REQUEST
+ */
+HTTP_CODE http_conn::write_body()
+{
+    int len = std::min(m_read_index - m_checked_index, m_content_length - m_body_received);
+    int written = 0;
+    while (written < len)
+    {
+        ssize_t n = ::write(m_body_fd, m_read_buf + m_checked_index + written, len - written);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return HTTP_CODE::INTERNAL_ERROR;
+        }
+        written += n;
+    }
+    m_body_received += len;
+    // 请求体后面可能是下一个请求的数据，挪到请求体的起始位置
+    int rest = m_read_index - m_checked_index - len;
+    memmove(m_read_buf + m_body_start, m_read_buf + m_checked_index + len, rest);
+    m_checked_index = m_body_start;
+    m_read_index = m_body_start + rest;
+    if (m_body_received < m_content_length)
+    {
+        return HTTP_CODE::NO_REQUEST;
+    }
+    lseek(m_body_fd, 0, SEEK_SET);
+    m_start_line = m_checked_index;
+    return HTTP_CODE::GET_REQUEST;
+}
+
+/**
+ * @brief 解码chunked编码的请求体。块数据原地挪到m_body_start后面拼起来，
+ * 解码后超过BODY_INLINE_MAX_SIZE时和write_body一样边收边写入临时文件
+ *
+ * @return HTTP_CODE 最后一块和trailer全部收到时返回GET_REQUEST
+ */
+HTTP_CODE http_conn::parse_chunked()
+{
+    bool finished = false;
+    while (!finished)
+    {
+        if (m_chunk_state == CHUNK_STATE_DATA)
+        {
+            int len = std::min(m_read_index - m_checked_index, m_chunk_remain);
+            memmove(m_read_buf + m_body_start + m_body_len, m_read_buf + m_checked_index, len);
+            m_body_len += len;
+            m_checked_index += len;
+            m_start_line = m_checked_index;
+            m_chunk_remain -= len;
+            if (m_chunk_remain > 0)
+            {
+                break;
+            }
+            m_chunk_state = CHUNK_STATE_DATA_END;
+            continue;
+        }
+        LINE_STATE line_state = parse_line();
+        if (line_state == LINE_BAD)
+        {
+            return BAD_REQUEST;
+        }
+        if (line_state == LINE_OPEN)
+        {
+            break;
+        }
+        char *text = get_line();
+        int len = m_checked_index - m_start_line - 2;
+        m_start_line = m_checked_index;
+        switch (m_chunk_state)
+        {
+        case CHUNK_STATE_SIZE:
+        {
+            // 十六进制的块大小，后面可能有;开头的扩展
+            int size = 0;
+            int i = 0;
+            for (; i < len && text[i] != ';' && text[i] != ' ' && text[i] != '\t'; i++)
+            {
+                int digit = hex_value(text[i]);
+                if (digit < 0 || size > (MAX_BODY_SIZE >> 4))
+                {
+                    return BAD_REQUEST;
+                }
+                size = size * 16 + digit;
+            }
+            if (i == 0 || size > MAX_BODY_SIZE - m_content_length)
+            {
+                return BAD_REQUEST;
+            }
+            m_content_length += size;
+            m_chunk_remain = size;
+            m_chunk_state = size == 0 ? CHUNK_STATE_TRAILER : CHUNK_STATE_DATA;
+            break;
+        }
+        case CHUNK_STATE_DATA_END:
+            if (len != 0)
+            {
+                return BAD_REQUEST;
+            }
+            m_chunk_state = CHUNK_STATE_SIZE;
+            break;
+        case CHUNK_STATE_TRAILER:
+            // trailer不使用，空行表示请求结束
+            finished = len == 0;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (m_body_fd == -1 && m_content_length > BODY_INLINE_MAX_SIZE && !open_body_file())
+    {
+        return HTTP_CODE::INTERNAL_ERROR;
+    }
+    if (!flush_chunked_body())
+    {
+        return HTTP_CODE::INTERNAL_ERROR;
+    }
+    if (!finished)
+    {
+        return HTTP_CODE::NO_REQUEST;
+    }
+    if (m_body_fd != -1)
+    {
+        lseek(m_body_fd, 0, SEEK_SET);
+    }
+    else
+    {
+        m_content = std::string_view(m_read_buf + m_body_start, m_body_len);
+    }
+    return HTTP_CODE::GET_REQUEST;
+}
+
+/**
+ * @brief 解码出来的数据写入临时文件(有的话)，块的格式部分已经用不到，
+ * 后面还没解析的数据挪到请求体后面，缓冲区不随请求体和块的个数增长
+ *
+ * @return false 写文件失败
+ */
+bool http_conn::flush_chunked_body()
+{
+    if (m_body_fd != -1)
+    {
+        int written = 0;
+        while (written < m_body_len)
+        {
+            ssize_t n = ::write(m_body_fd, m_read_buf + m_body_start + written, m_body_len - written);
+            if (n == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            written += n;
+        }
+        m_body_received += m_body_len;
+        m_body_len = 0;
+    }
+    // m_start_line之前的数据都已经处理过，未完成的行从m_start_line开始
+    int end = m_body_start + m_body_len;
+    int shift = m_start_line - end;
+    memmove(m_read_buf + end, m_read_buf + m_start_line, m_read_index - m_start_line);
+    m_read_index -= shift;
+    m_checked_index -= shift;
+    m_start_line = end;
+    return true;
+}
+
+/**
+ * @brief 创建保存请求体的匿名临时文件
+ *
+ * @return false 创建失败
+ */
+bool http_conn::open_body_file()
+{
+    m_body_fd = open(BODY_TEMP_DIR, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (m_body_fd == -1)
+    {
+        // 文件系统不支持O_TMPFILE
+        char path[] = BODY_TEMP_DIR "/webserver_body_XXXXXX";
+        m_body_fd = mkstemp(path);
+        if (m_body_fd == -1)
+        {
+            return false;
+        }
+        unlink(path);
+    }
+    m_body_received = 0;
+    return true;
+}
+
+/**
+ * @brief 读缓冲区扩大一倍。请求头中的string_view指向旧缓冲区，需要同样平移
+ *
+ * @return false 已经达到最大大小
+ */
+bool http_conn::grow_read_buf()
+{
+    if (m_read_buf_size >= READ_BUFFER_MAX_SIZE)
+    {
+        return false;
+    }
+    int new_size = m_read_buf_size * 2;
+    char *new_buf = new char[new_size];
+    memcpy(new_buf, m_read_buf, m_read_index);
+    char *old_buf = m_read_buf;
+    rebase_views(old_buf, new_buf);
+    if (m_read_buf_size > READ_BUFFER_SIZE)
+    {
+        delete[] old_buf;
+    }
+    else
+    {
+        buffer_pool::free(old_buf);
+    }
+    m_read_buf = new_buf;
+    m_read_buf_size = new_size;
+    return true;
+}
+
+/**
+ * @brief 请求中的string_view从old_base平移到new_base
+ *
+ * @param old_base
+ * @param new_base
+ */
+void http_conn::rebase_views(const char *old_base, const char *new_base)
+{
+    auto rebase = [old_base, new_base](std::string_view &view)
+    {
+        if (view.data() != NULL)
+        {
+            view = std::string_view(new_base + (view.data() - old_base), view.size());
+        }
+    };
+    rebase(m_url);
+    rebase(m_version);
+    rebase(m_content);
+    for (int i = 0; i < HEADER_KNOWN_NUM; i++)
+    {
+        rebase(m_known_headers[i]);
+    }
+    for (int i = 0; i < m_header_count; i++)
+    {
+        rebase(m_headers[i].m_name);
+        rebase(m_headers[i].m_value);
+    }
+}
+
+/**
+ * @brief 去掉缓冲区前面已经处理完的请求，当前请求挪到缓冲区开头。
+ * 待发送的响应不指向读缓冲区，发送期间也可以挪动
+ *
+ */
+void http_conn::compact_read_buf()
+{
+    int shift = m_request_start;
+    if (m_read_buf == NULL || shift == 0)
+    {
+        return;
+    }
+    memmove(m_read_buf, m_read_buf + shift, m_read_index - shift);
+    m_read_index -= shift;
+    m_checked_index -= shift;
+    m_start_line -= shift;
+    m_request_start = 0;
+    if (m_check_state == CHECK_STATE_CONTENT)
+    {
+        m_body_start -= shift;
+    }
+    rebase_views(m_read_buf + shift, m_read_buf);
+}
+
+/**
+ * @brief  解析一行数据(从状态机)。行尾的\r\n改成\0，数据不完整时停在原处，下次从这里继续
+ *
+ * @return LINE_STATE
+ */
+LINE_STATE http_conn::parse_line()
+{
+
+    char temp;
+    while (m_checked_index < m_read_index)
+    {
+        // 一次跳过一整段不含\r\n的数据
+        m_checked_index = scan_crlf(m_read_buf + m_checked_index, m_read_buf + m_read_index) - m_read_buf;
+        if (m_checked_index == m_read_index)
+        {
+            break;
+        }
+        temp = m_read_buf[m_checked_index];
+        if (temp == '\r')
+        {
+            if (m_checked_index + 1 == m_read_index)
+            {
                 return LINE_OPEN;
             }
-            else if (m_read_buf[m_checked_index + 1] == '\n')
+            else if (m_read_buf[m_checked_index + 1] == '\n')
+            {
+                m_read_buf[m_checked_index++] = '\0';
+                m_read_buf[m_checked_index++] = '\0';
+                return LINE_OK;
+            }
+            return LINE_BAD;
+        }
+        else if (temp == '\n')
+        {
+            // 只有\n没有\r
+            return LINE_BAD;
+        }
+    }
+    return LINE_STATE::LINE_OPEN;
+}
+
+/**
+ * @brief 查找请求的文件，准备响应的数据来源。
+ * 条件请求在读文件、映射和压缩之前判断。ETag取决于选中的表示，所以文件缓存未命中时仍然要open、fstat，
+ * 预压缩的兄弟文件也要在第一次协商时查找，两者的结果都缓存在文件缓存中，之后的重新验证没有系统调用。
+ * 压缩缓存的ETag由原文件的ETag决定，匹配时不查压缩缓存，不会为一个304提交压缩任务
+ *
+ * @return HTTP_CODE
+ */
+HTTP_CODE http_conn::do_request()
+{
+    if (m_bundle != NULL)
+    {
+        return do_bundle_request();
+    }
+    // 命中缓存时不需要stat、open
+    HTTP_CODE ret = m_file_cache->acquire(m_url, m_file, m_arena);
+    if (ret == HTTP_CODE::DIR_REQUEST)
+    {
+        m_file = NULL;
+        return m_dir_listing ? list_dir() : HTTP_CODE::BAD_REQUEST;
+    }
+    if (ret != HTTP_CODE::FILE_REQUEST)
+    {
+        m_file = NULL;
+        return ret;
+    }
+    m_content_type = content_type_line(m_file->m_path);
+    m_vary = find_mime_type(m_file->m_path).m_compressible;
+    CONTENT_ENCODING compress = ENCODING_IDENTITY;
+    if (m_method == METHOD::GET && m_vary)
+    {
+        compress = negotiate_encoding();
+    }
+    m_file_size = m_file->m_stat.st_size;
+    m_etag = std::string_view(m_file->m_etag, m_file->m_etag_len);
+    m_last_modified = m_file->m_last_modified;
+    m_mtime = m_file->m_stat.st_mtime;
+    m_full_size = m_file->m_stat.st_size;
+    if (m_method == METHOD::GET)
+    {
+        if (compress != ENCODING_IDENTITY)
+        {
+            // 先按压缩后的ETag验证，客户端缓存的还有效时不查压缩缓存
+            char *etag = (char *)m_arena.alloc(COMPRESSED_ETAG_SIZE, 1);
+            m_etag = std::string_view(etag, compressed_etag(m_file, compress, etag));
+            if (not_modified())
+            {
+                return HTTP_CODE::NOT_MODIFIED;
+            }
+            m_etag = std::string_view(m_file->m_etag, m_file->m_etag_len);
+            // 还没压缩好时先返回原文件，再按原文件的ETag验证
+            m_compressed = m_compress_cache->acquire(m_file, compress);
+            if (m_compressed != NULL)
             {
-                m_read_buf[m_checked_index++] = '\0';
-                m_read_buf[m_checked_index++] = '\0';
-                return LINE_OK;
+                m_encoding = compress;
+                m_file_size = m_compressed->m_len;
+                m_etag = std::string_view(m_compressed->m_etag, m_compressed->m_etag_len);
             }
         }
-        else if (temp == '\n')
+        // 客户端缓存的还有效时不需要读文件
+        if (m_compressed == NULL && not_modified())
         {
-            if (m_checked_index > 1 && m_read_buf[m_checked_index - 1] == '\r')
+            return HTTP_CODE::NOT_MODIFIED;
+        }
+        HTTP_CODE range = parse_range();
+        if (range == HTTP_CODE::PARTIAL_CONTENT)
+        {
+            return map_ranges();
+        }
+        if (range != HTTP_CODE::FILE_REQUEST)
+        {
+            return range;
+        }
+    }
+    if (m_compressed != NULL)
+    {
+        m_file_addr = m_compressed->m_data;
+        return HTTP_CODE::FILE_REQUEST;
+    }
+    off_t size = m_file->m_stat.st_size;
+    // 小文件发送缓存的响应，缓存的响应头是不压缩的
+    if (m_encoding == ENCODING_IDENTITY && use_cached_response())
+    {
+        return HTTP_CODE::FILE_REQUEST;
+    }
+    // io_uring后端没有sendfile，仍然映射文件
+    m_sendfile = m_use_sendfile && m_epoll_fd != -1;
+    if (m_sendfile)
+    {
+        m_file_fd = m_file->m_fd;
+        m_file_offset = 0;
+        m_file_remain = size;
+        return HTTP_CODE::FILE_REQUEST;
+    }
+    if (size > 0)
+    {
+        m_file_addr = m_file_cache->get_map(m_file);
+        if (m_file_addr == NULL)
+        {
+            // 大文件不占用缓存的映射额度，每次自己映射
+            m_file_addr = (char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, m_file->m_fd, 0);
+            if (m_file_addr == MAP_FAILED)
             {
-                m_read_buf[m_checked_index - 1] = '\0';
-                m_read_buf[m_checked_index++] = '\0';
-                return LINE_OK;
+                m_file_addr = NULL;
+                return HTTP_CODE::INTERNAL_ERROR;
             }
-            return LINE_BAD;
+            m_file_mapped = true;
+            m_file_map_len = size;
         }
-        m_checked_index++;
     }
-    return LINE_STATE::LINE_OK;
+    return HTTP_CODE::FILE_REQUEST;
 }
 
-HTTP_CODE http_conn::do_request()
+/**
+ * @brief 从打包文件返回。响应头是打包时生成好的，和文件缓存中的响应一样直接发送，
+ * 不需要任何系统调用，也不持有任何引用
+ *
+ * @return HTTP_CODE
+ */
+HTTP_CODE http_conn::do_bundle_request()
 {
-    // printf("%d %s %s\n", m_method, m_url.c_str(), m_version.c_str());
-    // for (std::map<std::string, std::string>::iterator i = m_headers.begin(); i != m_headers.end(); i++)
-    // {
-    //     std::cout << i->first << ":" << i->second << std::endl;
-    // }
-    // printf("%s\n", m_content.c_str());
-    std::string path = ROOT_PATH + m_url;
-    if (stat(path.c_str(), &m_file_stat) < 0)
+    char *path = (char *)m_arena.alloc(m_url.size() + 2, 1);
+    int len = normalize_url(m_url, path);
+    if (len <= 0)
+    {
+        // ..超出了根目录，或者是根目录本身，打包文件中没有目录
+        return HTTP_CODE::BAD_REQUEST;
+    }
+    std::string_view rel(path, len);
+    const bundle_file *file = m_bundle->find(rel);
+    if (file == NULL)
     {
         return HTTP_CODE::NO_RESOURCE;
     }
-    if (!(m_file_stat.st_mode & S_IROTH))
+    const bundle_repr *identity = &file->m_reprs[ENCODING_IDENTITY];
+    const bundle_repr *repr = identity;
+    m_content_type = content_type_line(rel);
+    m_vary = file->m_compressible;
+    std::string_view accept = get_header(HEADER_ACCEPT_ENCODING);
+    if (m_method == METHOD::GET && m_vary && accept.data() != NULL && get_header(HEADER_RANGE).data() == NULL)
     {
-        return HTTP_CODE::FORBIDDEN_REQUEST;
+        unsigned accepted = parse_accept_encoding(accept);
+        for (int i = 0; i < ENCODING_NUM; i++)
+        {
+            if ((accepted & (1u << i)) && file->m_reprs[i].m_offset != 0)
+            {
+                repr = &file->m_reprs[i];
+                m_encoding = (CONTENT_ENCODING)i;
+                break;
+            }
+        }
     }
-    if (S_ISDIR(m_file_stat.st_mode))
+    m_file_size = repr->m_body_len;
+    m_etag = std::string_view(repr->m_etag, repr->m_etag_len);
+    m_last_modified = file->m_last_modified;
+    m_mtime = file->m_mtime;
+    m_full_size = identity->m_body_len;
+    if (m_method == METHOD::GET)
     {
-        return HTTP_CODE::BAD_REQUEST;
+        if (not_modified())
+        {
+            return HTTP_CODE::NOT_MODIFIED;
+        }
+        HTTP_CODE range = parse_range();
+        if (range == HTTP_CODE::PARTIAL_CONTENT)
+        {
+            m_file_addr = (char *)m_bundle->data(identity->m_offset + identity->m_head_len);
+            return range;
+        }
+        if (range != HTTP_CODE::FILE_REQUEST)
+        {
+            return range;
+        }
     }
-    int fd = open(path.c_str(), O_RDONLY);
-    m_file_addr = (char *)mmap(NULL, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    close(fd);
+    m_cached_response = m_bundle->data(repr->m_offset);
+    m_cached_head_len = repr->m_head_len;
+    m_cached_response_len = repr->m_head_len + repr->m_body_len;
     return HTTP_CODE::FILE_REQUEST;
 }
 
-void http_conn::unmap()
+/**
+ * @brief 客户端接受压缩时，优先用预压缩的兄弟文件，m_file换成它，之后和普通文件一样零拷贝发送；
+ * 没有时返回要从压缩缓存取的编码，由do_request验证完条件请求再取。Range请求总是返回原文件的区间
+ *
+ * @return CONTENT_ENCODING 不需要压缩缓存时为ENCODING_IDENTITY
+ */
+CONTENT_ENCODING http_conn::negotiate_encoding()
+{
+    std::string_view accept = get_header(HEADER_ACCEPT_ENCODING);
+    if (accept.data() == NULL || get_header(HEADER_RANGE).data() != NULL)
+    {
+        return ENCODING_IDENTITY;
+    }
+    unsigned accepted = parse_accept_encoding(accept);
+    if (accepted == 0)
+    {
+        return ENCODING_IDENTITY;
+    }
+    for (int i = 0; i < ENCODING_NUM; i++)
+    {
+        if (!(accepted & (1u << i)))
+        {
+            continue;
+        }
+        file_entry *variant = m_file_cache->get_variant(m_file, (CONTENT_ENCODING)i, m_arena);
+        if (variant != NULL)
+        {
+            m_file_cache->release(m_file);
+            m_file = variant;
+            m_encoding = (CONTENT_ENCODING)i;
+            return ENCODING_IDENTITY;
+        }
+    }
+    if (m_compress_cache == NULL)
+    {
+        return ENCODING_IDENTITY;
+    }
+    // 只用客户端最优先的编码，不为一个客户端压缩多份
+    return (CONTENT_ENCODING)__builtin_ctz(accepted);
+}
+
+/**
+ * @brief 小文件使用缓存的完整响应，第一次请求时生成
+ *
+ * @return false 文件太大或者缓存已满
+ */
+bool http_conn::use_cached_response()
+{
+    if (!m_file_cache->can_cache_response(m_file))
+    {
+        return false;
+    }
+    size_t len = 0;
+    size_t head_len = 0;
+    const char *response = m_file_cache->get_response(m_file, len, head_len);
+    if (response == NULL)
+    {
+        // 第一次请求，生成响应头和文件内容一起放入缓存
+        append_file_head();
+        response = m_file_cache->set_response(m_file, std::string_view(m_response, m_response_len), len, head_len);
+        m_response = NULL;
+        m_response_len = 0;
+    }
+    if (response == NULL)
+    {
+        return false;
+    }
+    m_cached_response = response;
+    m_cached_response_len = len;
+    m_cached_head_len = head_len;
+    return true;
+}
+
+/**
+ * @brief 准备区间的数据来源。小文件直接取缓存的响应中的文件内容，
+ * 单个区间可以sendfile，大文件只映射区间覆盖的那几页，不映射整个文件
+ *
+ * @return HTTP_CODE
+ */
+HTTP_CODE http_conn::map_ranges()
 {
+    if (use_cached_response())
+    {
+        // 缓存的响应随m_file一起释放，这里只借用其中的文件内容
+        m_file_addr = (char *)m_cached_response + m_cached_head_len;
+        m_cached_response = NULL;
+        return HTTP_CODE::PARTIAL_CONTENT;
+    }
+    m_sendfile = m_range_num == 1 && m_use_sendfile && m_epoll_fd != -1;
+    if (m_sendfile)
+    {
+        m_file_fd = m_file->m_fd;
+        m_file_offset = m_ranges[0].m_start;
+        m_file_remain = m_ranges[0].m_len;
+        return HTTP_CODE::PARTIAL_CONTENT;
+    }
+    m_file_addr = m_file_cache->get_map(m_file);
     if (m_file_addr != NULL)
     {
-        munmap(m_file_addr, m_file_stat.st_size);
+        return HTTP_CODE::PARTIAL_CONTENT;
+    }
+    off_t start = m_ranges[0].m_start;
+    off_t end = start + m_ranges[0].m_len;
+    for (int i = 1; i < m_range_num; i++)
+    {
+        start = std::min(start, m_ranges[i].m_start);
+        end = std::max(end, m_ranges[i].m_start + m_ranges[i].m_len);
+    }
+    // mmap的偏移要按页对齐
+    static const off_t page_size = sysconf(_SC_PAGESIZE);
+    m_file_map_offset = start - start % page_size;
+    m_file_map_len = end - m_file_map_offset;
+    m_file_addr = (char *)mmap(NULL, m_file_map_len, PROT_READ, MAP_PRIVATE, m_file->m_fd, m_file_map_offset);
+    if (m_file_addr == MAP_FAILED)
+    {
+        m_file_addr = NULL;
+        m_file_map_len = 0;
+        m_file_map_offset = 0;
+        return HTTP_CODE::INTERNAL_ERROR;
+    }
+    m_file_mapped = true;
+    return HTTP_CODE::PARTIAL_CONTENT;
+}
+
+/**
+ * @brief 解析十进制的文件偏移
+ *
+ * @param str
+ * @param value
+ * @return false 不是数字或者溢出
+ */
+static bool parse_offset(std::string_view str, off_t &value)
+{
+    if (str.empty())
+    {
+        return false;
+    }
+    value = 0;
+    for (size_t i = 0; i < str.size(); i++)
+    {
+        if (str[i] < '0' || str[i] > '9' || value > (INT64_MAX - 9) / 10)
+        {
+            return false;
+        }
+        value = value * 10 + (str[i] - '0');
+    }
+    return true;
+}
+
+/**
+ * @brief 解析Range请求头，结果放在m_ranges中。If-Range和ETag、Last-Modified不一致，
+ * 格式不对、不是bytes单位、区间太多时都忽略Range返回整个文件。超出文件的区间去掉，不合并重叠的区间
+ *
+ * @return HTTP_CODE FILE_REQUEST、PARTIAL_CONTENT或RANGE_NOT_SATISFIABLE
+ */
+HTTP_CODE http_conn::parse_range()
+{
+    m_range_num = 0;
+    std::string_view range = get_header(HEADER_RANGE);
+    if (range.data() == NULL)
+    {
+        return HTTP_CODE::FILE_REQUEST;
+    }
+    // ETag是强验证器，直接比较；日期只接受和Last-Modified完全一样的
+    std::string_view if_range = get_header(HEADER_IF_RANGE);
+    if (if_range.data() != NULL && if_range != m_etag && if_range != m_last_modified)
+    {
+        return HTTP_CODE::FILE_REQUEST;
+    }
+    if (range.size() < 6 || !equal_nocase(range.substr(0, 6), "bytes="))
+    {
+        return HTTP_CODE::FILE_REQUEST;
+    }
+    range.remove_prefix(6);
+    off_t size = m_full_size;
+    int count = 0;
+    while (!range.empty())
+    {
+        size_t comma = range.find(',');
+        std::string_view spec = range.substr(0, comma);
+        range.remove_prefix(comma == std::string_view::npos ? range.size() : comma + 1);
+        while (!spec.empty() && (spec.front() == ' ' || spec.front() == '\t'))
+        {
+            spec.remove_prefix(1);
+        }
+        while (!spec.empty() && (spec.back() == ' ' || spec.back() == '\t'))
+        {
+            spec.remove_suffix(1);
+        }
+        if (spec.empty())
+        {
+            continue;
+        }
+        size_t dash = spec.find('-');
+        if (dash == std::string_view::npos || ++count > MAX_RANGE_NUM)
+        {
+            return HTTP_CODE::FILE_REQUEST;
+        }
+        std::string_view first = spec.substr(0, dash);
+        std::string_view last = spec.substr(dash + 1);
+        off_t start = 0;
+        off_t end = size;
+        if (first.empty())
+        {
+            // 最后n个字节
+            off_t suffix = 0;
+            if (!parse_offset(last, suffix))
+            {
+                return HTTP_CODE::FILE_REQUEST;
+            }
+            start = suffix == 0 ? size : std::max<off_t>(size - suffix, 0);
+        }
+        else
+        {
+            if (!parse_offset(first, start))
+            {
+                return HTTP_CODE::FILE_REQUEST;
+            }
+            off_t last_pos = 0;
+            if (!last.empty())
+            {
+                if (!parse_offset(last, last_pos) || last_pos < start)
+                {
+                    return HTTP_CODE::FILE_REQUEST;
+                }
+                end = std::min(last_pos + 1, size);
+            }
+        }
+        if (start < size)
+        {
+            m_ranges[m_range_num].m_start = start;
+            m_ranges[m_range_num].m_len = end - start;
+            m_range_num++;
+        }
+    }
+    if (count == 0)
+    {
+        return HTTP_CODE::FILE_REQUEST;
+    }
+    return m_range_num == 0 ? HTTP_CODE::RANGE_NOT_SATISFIABLE : HTTP_CODE::PARTIAL_CONTENT;
+}
+
+/**
+ * @brief 检查If-None-Match和If-Modified-Since。有If-None-Match时只看它，
+ * ETag按弱比较，W/前缀不影响结果
+ *
+ * @return true 客户端缓存的文件和现在的一致
+ */
+bool http_conn::not_modified()
+{
+    std::string_view etag = m_etag;
+    std::string_view if_none_match = get_header(HEADER_IF_NONE_MATCH);
+    if (if_none_match.data() != NULL)
+    {
+        while (!if_none_match.empty())
+        {
+            size_t comma = if_none_match.find(',');
+            std::string_view tag = if_none_match.substr(0, comma);
+            if_none_match.remove_prefix(comma == std::string_view::npos ? if_none_match.size() : comma + 1);
+            while (!tag.empty() && (tag.front() == ' ' || tag.front() == '\t'))
+            {
+                tag.remove_prefix(1);
+            }
+            while (!tag.empty() && (tag.back() == ' ' || tag.back() == '\t'))
+            {
+                tag.remove_suffix(1);
+            }
+            if (tag.compare(0, 2, "W/") == 0)
+            {
+                tag.remove_prefix(2);
+            }
+            if (tag == "*" || tag == etag)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+    std::string_view if_modified_since = get_header(HEADER_IF_MODIFIED_SINCE);
+    if (if_modified_since.data() == NULL)
+    {
+        return false;
+    }
+    // 客户端一般原样带回Last-Modified，相同时不需要解析
+    if (if_modified_since == m_last_modified)
+    {
+        return true;
+    }
+    time_t since = parse_http_date(if_modified_since);
+    return since != -1 && m_mtime <= since;
+}
+
+/**
+ * @brief 用流式响应返回目录列表
+ *
+ * @return HTTP_CODE
+ */
+HTTP_CODE http_conn::list_dir()
+{
+    std::string_view dir_url;
+    int fd = m_file_cache->open_dir(m_url, m_arena, dir_url);
+    if (fd == -1)
+    {
+        return HTTP_CODE::NO_RESOURCE;
+    }
+    m_chunk_source = new dir_listing(fd, dir_url);
+    // HTTP/1.0不认识chunked，直接发送内容，用关闭连接表示结束
+    m_chunk_framing = m_version == "HTTP/1.1";
+    if (!m_chunk_framing)
+    {
+        m_linger = false;
+    }
+    m_chunk_end = false;
+    return HTTP_CODE::FILE_REQUEST;
+}
+
+/**
+ * @brief 之前的数据已经发送完，m_iv换成流式响应的下一块
+ *
+ * @return false 流式响应已经结束或出错，出错时不再保持连接
+ */
+bool http_conn::next_chunk()
+{
+    if (m_chunk_source == NULL)
+    {
+        return false;
+    }
+    m_iv_count = 0;
+    m_iv_mapped = 0;
+    m_bytes_to_send = 0;
+    return append_chunk();
+}
+
+/**
+ * @brief 从m_chunk_source取下一块追加到m_iv。
+ * 块数据直接生成在m_chunk_buf中，前后留出块大小行和\r\n的位置，不需要再复制
+ *
+ * @return false 流式响应已经结束或出错
+ */
+bool http_conn::append_chunk()
+{
+    if (m_chunk_end)
+    {
+        end_chunked();
+        return false;
+    }
+    if (m_chunk_buf == NULL)
+    {
+        m_chunk_buf = buffer_pool::alloc();
+    }
+    char *data = m_chunk_buf + CHUNK_HEAD_SIZE;
+    int len = m_chunk_source->read(data, buffer_pool::buffer_size() - CHUNK_HEAD_SIZE - CHUNK_TAIL_SIZE);
+    if (len < 0 || (len == 0 && !m_chunk_framing))
+    {
+        // 出错时已经发出去的状态行改不了，只能关闭连接让客户端知道响应不完整
+        m_keep_alive = m_keep_alive && len == 0;
+        end_chunked();
+        return false;
+    }
+    m_chunk_end = len == 0;
+    if (!m_chunk_framing)
+    {
+        add_iov(data, len);
+        return true;
+    }
+    if (len == 0)
+    {
+        // 最后一块，没有trailer
+        add_iov("0\r\n\r\n", 5);
+        return true;
+    }
+    char head[CHUNK_HEAD_SIZE + 1];
+    int head_len = snprintf(head, sizeof(head), "%x\r\n", len);
+    memcpy(data - head_len, head, head_len);
+    memcpy(data + len, "\r\n", CHUNK_TAIL_SIZE);
+    add_iov(data - head_len, head_len + len + CHUNK_TAIL_SIZE);
+    return true;
+}
+
+/**
+ * @brief 释放流式响应的数据来源和缓冲区
+ *
+ */
+void http_conn::end_chunked()
+{
+    delete m_chunk_source;
+    m_chunk_source = NULL;
+    if (m_chunk_buf != NULL)
+    {
+        buffer_pool::free(m_chunk_buf);
+        m_chunk_buf = NULL;
+    }
+    m_chunk_end = false;
+}
+
+void http_conn::unmap()
+{
+    end_chunked();
+    for (int i = 0; i < m_queued_num; i++)
+    {
+        if (m_queued[i].m_map != NULL)
+        {
+            munmap(m_queued[i].m_map, m_queued[i].m_map_len);
+        }
+        if (m_queued[i].m_file != NULL)
+        {
+            m_file_cache->release(m_queued[i].m_file);
+        }
+        if (m_queued[i].m_compressed != NULL)
+        {
+            m_compress_cache->release(m_queued[i].m_compressed);
+        }
+    }
+    m_queued_num = 0;
+    if (m_file_mapped)
+    {
+        munmap(m_file_addr, m_file_map_len);
+        m_file_mapped = false;
+        m_file_map_len = 0;
+    }
+    m_file_map_offset = 0;
+    m_file_addr = NULL;
+    m_cached_response = NULL;
+    if (m_compressed != NULL)
+    {
+        m_compress_cache->release(m_compressed);
+        m_compressed = NULL;
+    }
+    m_encoding = ENCODING_IDENTITY;
+    m_file_fd = -1;
+    m_file_remain = 0;
+    if (m_file != NULL)
+    {
+        m_file_cache->release(m_file);
+        m_file = NULL;
+    }
+}
+void http_conn::free_buffer()
+{
+    if (m_read_buf_size > READ_BUFFER_SIZE)
+    {
+        delete[] m_read_buf;
+    }
+    else
+    {
+        buffer_pool::free(m_read_buf);
     }
+    m_read_buf = NULL;
+    m_read_buf_size = 0;
+    m_read_index = 0;
 }
+
 void http_conn::set_timer(conn_timer *timer)
 {
     m_timer = timer;
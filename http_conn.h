@@ -10,7 +10,8 @@
 #include <errno.h>
 #include <string>
 #include <string.h>
-#include <regex>
+#include <string_view>
+#include <algorithm>
 #include <map>
 #include <unordered_map>
 #include <sys/types.h>
@@ -19,26 +20,60 @@
 #include <sys/mman.h>
 #include <iconv.h>
 #include <sys/uio.h>
-#define READ_BUFFER_SIZE 2048
-#define WRITE_BUFFER_SIZE 1024
+#include <sys/sendfile.h>
+#include <atomic>
+#include <stdint.h>
+#include "buffer_pool.h"
+#include "arena.h"
+#include "chunk_source.h"
+#include "http_header.h"
+// 读缓冲区从缓冲区池借用
+#define READ_BUFFER_SIZE BUFFER_POOL_BUFFER_SIZE
+// 请求头放不下时读缓冲区成倍扩大，最大到这个大小
+#define READ_BUFFER_MAX_SIZE (64 * 1024)
+// 不超过这个大小的请求体放在读缓冲区里，更大的流式写入临时文件
+#define BODY_INLINE_MAX_SIZE READ_BUFFER_SIZE
+// 请求体的最大长度
+#define MAX_BODY_SIZE (1024 * 1024 * 1024)
+// 请求体临时文件所在目录
+#define BODY_TEMP_DIR "/tmp"
+// 每个请求最多保存的不认识的请求头个数
+#define MAX_HEADER_NUM 32
+// 流水线请求一次最多合并发送的响应数
+#define MAX_PIPELINE_NUM 16
+// 一个Range请求最多返回的区间数，更多时忽略Range返回整个文件
+#define MAX_RANGE_NUM 8
+// 一个响应最多占用的iovec数：响应头，每个区间的分段头和数据，结束分隔符
+#define MAX_RESPONSE_IOV (MAX_RANGE_NUM * 2 + 2)
+// 一批响应的iovec总数
+#define MAX_IOV_NUM (MAX_PIPELINE_NUM * 3)
+static_assert(MAX_IOV_NUM <= 64, "m_iv_mapped每个iovec一位");
+// 流式响应每块前面留给块大小行的字节数
+#define CHUNK_HEAD_SIZE 8
+// 流式响应每块后面留给\r\n的字节数
+#define CHUNK_TAIL_SIZE 2
 class conn_timer;
+class file_cache;
+class compress_cache;
+struct compressed_entry;
+class bundle;
+class prefetcher;
+class prefetch_done_queue;
+/// @brief 连接句柄，由连接表分配，带有代数，连接关闭后失效
+typedef uint64_t conn_handle;
+struct file_entry;
 /// @brief 项目根目录
 const std::string ROOT_PATH = "/home/mkh/桌面/webserver-front/src";
-/// @brief HTTP 状态码
-const std::map<std::string, std::string> HTTP_STATUS_CODE = {
-    // 请求成功
-    {"200", "OK"},
-    // 客户端请求的语法错误，服务器无法理解
-    {"400", "Bad Request"},
-    // 服务器理解请求客户端的请求，但是拒绝执行此请求
-    {"403", "Forbidden"},
-    // 服务器无法根据客户端的请求找到资源（网页）
-    {"404", "Not Found"},
-    // 服务器内部错误，无法完成请求
-    {"500", "Internal Server Error"}
-
+/// @brief 响应的内容编码，按优先级排列
+enum CONTENT_ENCODING
+{
+    ENCODING_BR,
+    ENCODING_GZIP,
+    // 支持的压缩编码个数
+    ENCODING_NUM,
+    // 不压缩
+    ENCODING_IDENTITY = ENCODING_NUM,
 };
-
 /// @brief 服务器处理HTTP请求的结果
 enum HTTP_CODE
 {
@@ -58,6 +93,14 @@ enum HTTP_CODE
     INTERNAL_ERROR = 500,
     // 客户端已关闭连接
     CLOSED_CONNECTION = 2,
+    // 请求的是目录
+    DIR_REQUEST = 3,
+    // 客户端缓存的文件仍然有效
+    NOT_MODIFIED = 304,
+    // 返回文件的一部分
+    PARTIAL_CONTENT = 206,
+    // 请求的区间都不在文件范围内
+    RANGE_NOT_SATISFIABLE = 416,
 };
 
 /// @brief 主状态机的状态
@@ -82,6 +125,19 @@ enum LINE_STATE
     LINE_OPEN,
 };
 
+/// @brief chunked编码的请求体的解析状态
+enum CHUNK_STATE
+{
+    // 正在分析块大小行
+    CHUNK_STATE_SIZE,
+    // 正在接收块数据
+    CHUNK_STATE_DATA,
+    // 块数据后面的\r\n
+    CHUNK_STATE_DATA_END,
+    // 最后一块之后的trailer
+    CHUNK_STATE_TRAILER,
+};
+
 /// @brief HTTP请求方法，暂时只支持GET
 enum METHOD
 {
@@ -94,55 +150,177 @@ enum METHOD
     OPTIONS,
     PATCH
 };
+/// @brief 不认识的请求头，名字和值都指向读缓冲区
+struct header_field
+{
+    std::string_view m_name;
+    std::string_view m_value;
+};
+
+/// @brief 已经生成、等待发送的响应占用的文件，整批发送完后释放
+struct queued_file
+{
+    file_entry *m_file;
+    char *m_map; // 连接自己的映射，没有时为NULL
+    size_t m_map_len;
+    compressed_entry *m_compressed; // 压缩缓存中的内容，没有时为NULL
+};
+
+/// @brief Range请求的一个区间
+struct byte_range
+{
+    off_t m_start;
+    off_t m_len;
+};
+
 class http_conn
 {
 public:
-    static int m_epoll_fd;
-    static int m_user_num;
+    static std::atomic<int> m_user_num;
+    static bool m_use_sendfile; // 文件用sendfile发送，不再mmap
+    static file_cache *m_file_cache; // 所有连接共享的打开文件缓存
+    static bool m_dir_listing; // 请求目录时返回目录列表
+    static compress_cache *m_compress_cache; // 没有预压缩文件时在后台压缩，NULL表示不压缩
+    static bundle *m_bundle; // 打包的根目录，不为NULL时所有文件都从它返回
+    static prefetcher *m_prefetcher; // 发送前检查文件内容是否在页缓存中，NULL表示不检查
 
+    http_conn();
     void process(); // 线程用来处理http请求的函数
     bool read();    // 读数据
     bool write();   // 写数据
-    void init(int sockfd, struct sockaddr_in sockaddr);
+    // prefetch_done是所属事件循环的预读完成队列，为NULL时不预读
+    void init(int sockfd, struct sockaddr_in sockaddr, int epoll_fd, conn_handle handle, prefetch_done_queue *prefetch_done = NULL);
     void close_conn();
 
+    bool process_requests();                  // 解析缓冲区中所有完整的请求并生成响应，返回false需要关闭连接
     HTTP_CODE process_read();                 // 解析HTTP请求
-    bool process_write(HTTP_CODE http_code);  // 生成HTTP响应
-    HTTP_CODE parse_request_line(char *text); // 解析HTTP请求首行
-    HTTP_CODE parse_header(char *text);       // 解析HTTP请求头
-    HTTP_CODE parse_content(char *text);      // 解析HTTP请求体
+    bool process_write(HTTP_CODE http_code);  // 生成HTTP响应，追加到待发送的响应后面
+    HTTP_CODE parse_request_line(char *text, int len); // 解析HTTP请求首行
+    HTTP_CODE parse_header(char *text, int len);       // 解析HTTP请求头
+    HTTP_CODE parse_content(char *text);               // 解析HTTP请求体
+    HTTP_CODE write_body();                            // 把收到的请求体写入临时文件
+    HTTP_CODE parse_chunked();                         // 解码chunked编码的请求体
+    int get_body_fd() { return m_body_fd; }            // 流式接收的请求体，没有时为-1
+    std::string_view get_header(std::string_view name); // 查找请求头，不区分大小写
+    std::string_view get_header(HEADER_ID id) { return m_known_headers[id]; } // 已知的请求头，没有时为空
 
     LINE_STATE parse_line(); // 解析一行数据(从状态机)
 
     HTTP_CODE do_request();
-    void unmap();
+    HTTP_CODE do_bundle_request(); // 从打包文件返回
+    bool not_modified(); // 条件请求的验证器和文件一致，可以回应304
+    HTTP_CODE parse_range(); // 解析Range和If-Range，返回FILE_REQUEST表示返回整个文件
+    CONTENT_ENCODING negotiate_encoding(); // 按Accept-Encoding选择预压缩文件，返回要从压缩缓存取的编码
+    void unmap(); // 释放响应占用的文件
+    bool next_chunk(); // 流式响应取下一块追加到待发送的数据，返回false表示已经结束
+    void free_buffer(); // 把读缓冲区还给缓冲区池
+    void reset_arena() { m_arena.reset(); } // 释放请求级的临时数据
+
+    // 以下供不经过read()/write()的IO后端(io_uring)使用
+    bool append_read(const char *data, int len); // 追加收到的数据
+    const struct iovec *get_iov(int &count);     // 待发送的响应
+    bool iov_mapped(int i) { return m_iv_mapped & ((uint64_t)1 << i); } // m_iv[i]是文件映射中的数据
+    bool finish_write();                         // 响应发送完毕，返回是否保持连接
+    bool has_pending_input();                    // 响应发送完后读缓冲区中还有没解析的数据
     void set_timer(conn_timer *timer);
     conn_timer *get_timer();
+    conn_handle get_handle() { return m_handle; }
+    int get_sockfd() { return m_sockfd; }
+    void prefetch_failed() { m_prefetch_failed = true; } // 预读失败，这一批剩下的数据直接发送
 
 private:
     int m_sockfd;
+    int m_epoll_fd; // 连接所属事件循环的epoll
+    conn_handle m_handle; // 在连接表中的句柄，也是epoll事件的data
+    prefetch_done_queue *m_prefetch_done; // 预读完成后由所属事件循环接着发送
     sockaddr_in m_sockaddr;
-    char m_read_buf[READ_BUFFER_SIZE];
+    char *m_read_buf; // 有数据要处理时才从缓冲区池借用，否则为NULL
+    int m_read_buf_size; // 读缓冲区大小，超过READ_BUFFER_SIZE时是单独申请的
     int m_read_index; // 下次读取客户端数据的起始下标
-    char m_write_buf[WRITE_BUFFER_SIZE];
 
+    int m_request_start;       // 当前请求的起始位置，前面是已经处理完的流水线请求
     int m_checked_index;       // 当前检查的字符位置
     int m_start_line;          // 当前行的起始位置
     CHECK_STATE m_check_state; // 主状态机的状态
 
-    std::string m_url;                            // 请求的文件
-    std::string m_version;                        // HTTP版本
-    METHOD m_method;                              // 请求的方法
-    bool m_linger;                                // 是否要保持连接
-    std::map<std::string, std::string> m_headers; // 请求头
+    // 以下string_view都指向m_read_buf，下一个请求开始前有效
+    std::string_view m_url;                   // 请求的文件
+    std::string_view m_version;               // HTTP版本
+    METHOD m_method;                          // 请求的方法
+    bool m_linger;                            // 是否要保持连接
+    std::string_view m_known_headers[HEADER_KNOWN_NUM]; // 已知的请求头，按HEADER_ID存放
+    header_field m_headers[MAX_HEADER_NUM];   // 其他请求头
+    int m_header_count;
     int m_content_length;
-    std::string m_content;
-    struct stat m_file_stat;
-    struct iovec m_iv[2];
+    std::string_view m_content;
+    int m_body_fd;          // 请求体临时文件，请求体较小时为-1
+    int m_body_start;       // 请求体在读缓冲区中的起始位置
+    int m_body_received;    // 已经写入临时文件的字节数
+    bool m_chunked;         // 请求体是chunked编码
+    CHUNK_STATE m_chunk_state;
+    int m_chunk_remain;     // 当前块还没有收到的字节数
+    int m_body_len;         // chunked请求体解码后留在读缓冲区中的字节数
+    file_entry *m_file; // 本次响应的文件，来自文件缓存，选中预压缩文件时是它
+    off_t m_file_size;  // 本次响应的文件内容的长度
+    std::string_view m_content_type; // 完整的Content-Type响应头，按请求的路径而不是预压缩文件的路径
+    std::string_view m_etag; // 选中的表示的ETag
+    std::string_view m_last_modified; // Last-Modified的值
+    time_t m_mtime;
+    off_t m_full_size;  // 原文件的大小，区间都相对原文件
+    bool m_vary;        // 文件可以压缩，响应随Accept-Encoding不同
+    CONTENT_ENCODING m_encoding;
+    compressed_entry *m_compressed; // 压缩缓存中的内容
+    struct iovec m_iv[MAX_IOV_NUM]; // 整批一次发送
+    uint64_t m_iv_mapped;           // 第i位表示m_iv[i]在文件映射中，可能不在页缓存里
+    bool m_prefetch_failed;         // 这一批预读失败过，不再检查页缓存，由发送自己报错
     int m_iv_count;
+    size_t m_bytes_to_send; // m_iv中还没有发送的字节数
+    queued_file m_queued[MAX_PIPELINE_NUM]; // m_iv中的响应占用的文件
+    int m_queued_num;
+    bool m_keep_alive;     // 最后一个生成的响应是否保持连接
     char *m_file_addr;
-    std::string m_response;
+    bool m_file_mapped;    // m_file_addr是本连接自己的映射，需要munmap
+    size_t m_file_map_len; // 自己映射的长度
+    off_t m_file_map_offset; // m_file_addr对应的文件偏移，区间请求只映射用到的部分
+    byte_range m_ranges[MAX_RANGE_NUM];
+    int m_range_num;
+    const char *m_cached_response; // 文件缓存中的响应，属于文件缓存
+    size_t m_cached_response_len;
+    size_t m_cached_head_len; // 其中状态行和响应头的长度
+    bool m_sendfile;       // 本次响应的文件用sendfile发送
+    int m_file_fd;         // sendfile的文件，属于文件缓存
+    off_t m_file_offset;   // 下次sendfile的文件偏移
+    size_t m_file_remain;  // 文件还没有发送的字节数
+    chunk_source *m_chunk_source; // 流式响应的数据来源，响应结束后释放
+    char *m_chunk_buf;     // 流式响应当前块的缓冲区，从缓冲区池借用
+    bool m_chunk_framing;  // 按chunked编码分块，HTTP/1.0不分块，发完关闭连接
+    bool m_chunk_end;      // 最后一块已经取出
+    arena m_arena;       // 本批请求的临时数据，响应发送完后整体释放
+    char *m_response;    // 响应头，从m_arena分配，结尾有\0
+    size_t m_response_len;
+    void append_response(std::string_view str);
+    void append_file_head();
+    void append_validators();
+    void append_content_length(uint64_t len);
+    void append_content_range(off_t start, off_t len);
+    void append_ranges();
+    HTTP_CODE map_ranges();
+    bool use_cached_response();
+    void append_tail();
     void init(); // 初始化其他信息
+    void next_request(); // 清空解析状态，准备解析下一个请求，不动读缓冲区
+    void add_iov(const void *data, size_t len, bool mapped = false);
+    bool prefetch_iov();
+    bool prefetch_file();
+    void compact_read_buf();
+    void rebase_views(const char *old_base, const char *new_base);
+    void consume_iov(size_t len);
+    bool grow_read_buf();
+    bool open_body_file();
+    bool flush_chunked_body();
+    HTTP_CODE list_dir();
+    bool append_chunk();
+    void end_chunked();
 
     char *get_line() { return m_read_buf + m_start_line; };
     conn_timer *m_timer;
@@ -150,7 +328,7 @@ private:
 
 #endif // !HTTPCONNECTION_H
 
-void epoll_add(int epoll_fd, int sock_fd, bool one_shot);
+void epoll_add(int epoll_fd, int sock_fd, uint64_t data, bool one_shot);
 void epoll_remove(int epoll_fd, int sock_fd);
-void epoll_modify(int epoll_fd, int sock_fd, int ev);
+void epoll_modify(int epoll_fd, int sock_fd, uint64_t data, int ev);
 void close_connection();
@@ -0,0 +1,162 @@
+#ifndef HTTP_HEADER_H
+#define HTTP_HEADER_H
+
+#include <stdint.h>
+#include <string_view>
+
+/// @brief 已知的请求头，每个有固定的槽位
+enum HEADER_ID
+{
+    HEADER_HOST,
+    HEADER_CONNECTION,
+    HEADER_CONTENT_LENGTH,
+    HEADER_CONTENT_TYPE,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_ACCEPT,
+    HEADER_ACCEPT_ENCODING,
+    HEADER_ACCEPT_LANGUAGE,
+    HEADER_USER_AGENT,
+    HEADER_REFERER,
+    HEADER_COOKIE,
+    HEADER_AUTHORIZATION,
+    HEADER_CACHE_CONTROL,
+    HEADER_PRAGMA,
+    HEADER_IF_NONE_MATCH,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_IF_MATCH,
+    HEADER_IF_UNMODIFIED_SINCE,
+    HEADER_IF_RANGE,
+    HEADER_RANGE,
+    HEADER_EXPECT,
+    HEADER_UPGRADE,
+    HEADER_ORIGIN,
+    HEADER_TE,
+    HEADER_KEEP_ALIVE,
+    // 已知请求头的个数
+    HEADER_KNOWN_NUM,
+    // 不认识的请求头
+    HEADER_UNKNOWN = HEADER_KNOWN_NUM,
+};
+
+/// @brief 已知请求头的名字，小写，顺序和HEADER_ID一致
+constexpr std::string_view KNOWN_HEADERS[HEADER_KNOWN_NUM] = {
+    "host",
+    "connection",
+    "content-length",
+    "content-type",
+    "transfer-encoding",
+    "accept",
+    "accept-encoding",
+    "accept-language",
+    "user-agent",
+    "referer",
+    "cookie",
+    "authorization",
+    "cache-control",
+    "pragma",
+    "if-none-match",
+    "if-modified-since",
+    "if-match",
+    "if-unmodified-since",
+    "if-range",
+    "range",
+    "expect",
+    "upgrade",
+    "origin",
+    "te",
+    "keep-alive",
+};
+
+// 完美哈希表的槽位数(2的幂)
+#define HEADER_HASH_SIZE 64
+
+/**
+ * @brief 不区分大小写的FNV-1a。字母和'-'、数字或上0x20后不变或变成小写，不需要分支
+ *
+ * @param name
+ * @param seed
+ * @return uint32_t
+ */
+constexpr uint32_t header_hash(std::string_view name, uint32_t seed)
+{
+    uint32_t h = seed;
+    for (size_t i = 0; i < name.size(); i++)
+    {
+        h = (h ^ (uint8_t)(name[i] | 0x20)) * 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+/**
+ * @brief 编译期找一个让所有已知请求头落在不同槽位的种子
+ *
+ * @return uint32_t 找不到时返回0
+ */
+constexpr uint32_t find_header_seed()
+{
+    for (uint32_t seed = 2166136261u; seed < 2166136261u + 10000; seed++)
+    {
+        bool used[HEADER_HASH_SIZE] = {};
+        bool ok = true;
+        for (int i = 0; i < HEADER_KNOWN_NUM && ok; i++)
+        {
+            uint32_t slot = header_hash(KNOWN_HEADERS[i], seed) & (HEADER_HASH_SIZE - 1);
+            ok = !used[slot];
+            used[slot] = true;
+        }
+        if (ok)
+        {
+            return seed;
+        }
+    }
+    return 0;
+}
+
+constexpr uint32_t HEADER_HASH_SEED = find_header_seed();
+static_assert(HEADER_HASH_SEED != 0, "已知请求头没有找到完美哈希，需要增大HEADER_HASH_SIZE");
+
+/// @brief 槽位到HEADER_ID的表，空槽位是HEADER_UNKNOWN
+struct header_hash_table
+{
+    uint8_t m_ids[HEADER_HASH_SIZE];
+
+    constexpr header_hash_table() : m_ids()
+    {
+        for (int i = 0; i < HEADER_HASH_SIZE; i++)
+        {
+            m_ids[i] = HEADER_UNKNOWN;
+        }
+        for (int i = 0; i < HEADER_KNOWN_NUM; i++)
+        {
+            m_ids[header_hash(KNOWN_HEADERS[i], HEADER_HASH_SEED) & (HEADER_HASH_SIZE - 1)] = i;
+        }
+    }
+};
+
+constexpr header_hash_table HEADER_TABLE;
+
+/**
+ * @brief 按名字查找已知请求头，不区分大小写。算一次哈希，最多比较一次名字
+ *
+ * @param name
+ * @return HEADER_ID 不认识时返回HEADER_UNKNOWN
+ */
+inline HEADER_ID find_header(std::string_view name)
+{
+    HEADER_ID id = (HEADER_ID)HEADER_TABLE.m_ids[header_hash(name, HEADER_HASH_SEED) & (HEADER_HASH_SIZE - 1)];
+    if (id == HEADER_UNKNOWN || name.size() != KNOWN_HEADERS[id].size())
+    {
+        return HEADER_UNKNOWN;
+    }
+    std::string_view known = KNOWN_HEADERS[id];
+    for (size_t i = 0; i < name.size(); i++)
+    {
+        if ((uint8_t)(name[i] | 0x20) != (uint8_t)known[i])
+        {
+            return HEADER_UNKNOWN;
+        }
+    }
+    return id;
+}
+
+#endif // !HTTP_HEADER_H
@@ -0,0 +1,151 @@
+#include "http_response.h"
+#include <stdio.h>
+#include <string.h>
+
+char http_date::m_lines[2][64] = {"Date: Thu, 01 Jan 1970 00:00:00 GMT\r\n", "Date: Thu, 01 Jan 1970 00:00:00 GMT\r\n"};
+std::atomic<int> http_date::m_index(0);
+std::atomic<time_t> http_date::m_time(0);
+
+// strftime的星期和月份跟随locale，HTTP要求英文
+static const char *const DAYS[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+static const char *const MONTHS[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+void format_http_date(time_t t, char *buf)
+{
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    // 年份超过4位时截断，不会越界
+    snprintf(buf, HTTP_DATE_SIZE, "%s, %02d %s %04d %02d:%02d:%02d GMT",
+             DAYS[tm.tm_wday], tm.tm_mday, MONTHS[tm.tm_mon], (tm.tm_year + 1900) % 10000, tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+/**
+ * @brief 解析"Sun, 06 Nov 1994 08:49:37 GMT"，不支持已经废弃的RFC 850和asctime格式
+ *
+ * @param str
+ * @return time_t 格式不对时返回-1
+ */
+time_t parse_http_date(std::string_view str)
+{
+    if (str.size() != HTTP_DATE_SIZE - 1 || str[3] != ',' || str.substr(25) != " GMT")
+    {
+        return -1;
+    }
+    auto number = [str](size_t pos, size_t len)
+    {
+        int n = 0;
+        for (size_t i = pos; i < pos + len; i++)
+        {
+            if (str[i] < '0' || str[i] > '9')
+            {
+                return -1;
+            }
+            n = n * 10 + (str[i] - '0');
+        }
+        return n;
+    };
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_mday = number(5, 2);
+    tm.tm_year = number(12, 4) - 1900;
+    tm.tm_hour = number(17, 2);
+    tm.tm_min = number(20, 2);
+    tm.tm_sec = number(23, 2);
+    tm.tm_mon = -1;
+    for (int i = 0; i < 12; i++)
+    {
+        if (str.substr(8, 3) == MONTHS[i])
+        {
+            tm.tm_mon = i;
+        }
+    }
+    if (tm.tm_mday < 1 || tm.tm_year < 70 || tm.tm_hour < 0 || tm.tm_min < 0 || tm.tm_sec < 0 || tm.tm_mon < 0)
+    {
+        return -1;
+    }
+    return timegm(&tm);
+}
+
+/**
+ * @brief 解析"gzip;q=0.8, br, *;q=0"这样的列表，q为0表示不接受，没有列出的编码跟随*
+ *
+ * @param value
+ * @return unsigned
+ */
+unsigned parse_accept_encoding(std::string_view value)
+{
+    auto trim = [](std::string_view str)
+    {
+        while (!str.empty() && (str.front() == ' ' || str.front() == '\t'))
+        {
+            str.remove_prefix(1);
+        }
+        while (!str.empty() && (str.back() == ' ' || str.back() == '\t'))
+        {
+            str.remove_suffix(1);
+        }
+        return str;
+    };
+    unsigned accepted = 0;
+    unsigned rejected = 0;
+    bool wildcard = false;
+    while (!value.empty())
+    {
+        size_t comma = value.find(',');
+        std::string_view item = value.substr(0, comma);
+        value.remove_prefix(comma == std::string_view::npos ? value.size() : comma + 1);
+        size_t semi = item.find(';');
+        std::string_view name = trim(item.substr(0, semi));
+        bool zero = false;
+        if (semi != std::string_view::npos)
+        {
+            std::string_view param = trim(item.substr(semi + 1));
+            if (param.size() > 2 && (param[0] | 0x20) == 'q' && param[1] == '=')
+            {
+                zero = param.find_first_not_of("0.", 2) == std::string_view::npos;
+            }
+        }
+        if (name == "*")
+        {
+            wildcard = !zero;
+            continue;
+        }
+        for (int i = 0; i < ENCODING_NUM; i++)
+        {
+            if (name.size() != ENCODINGS[i].m_name.size())
+            {
+                continue;
+            }
+            size_t j = 0;
+            while (j < name.size() && (name[j] | 0x20) == ENCODINGS[i].m_name[j])
+            {
+                j++;
+            }
+            if (j == name.size())
+            {
+                (zero ? rejected : accepted) |= 1u << i;
+            }
+        }
+    }
+    if (wildcard)
+    {
+        accepted |= (1u << ENCODING_NUM) - 1;
+    }
+    return accepted & ~rejected;
+}
+
+void http_date::update()
+{
+    time_t now = time(NULL);
+    time_t last = m_time.load(std::memory_order_relaxed);
+    // 多个事件循环同时发现秒数变了，只有一个去格式化
+    if (now == last || !m_time.compare_exchange_strong(last, now, std::memory_order_relaxed))
+    {
+        return;
+    }
+    int next = 1 - m_index.load(std::memory_order_relaxed);
+    memcpy(m_lines[next], "Date: ", 6);
+    format_http_date(now, m_lines[next] + 6);
+    memcpy(m_lines[next] + 6 + HTTP_DATE_SIZE - 1, "\r\n", 3);
+    m_index.store(next, std::memory_order_release);
+}
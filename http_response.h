@@ -0,0 +1,324 @@
+#ifndef HTTP_RESPONSE_H
+#define HTTP_RESPONSE_H
+
+#include "http_conn.h"
+#include "http_header.h"
+#include <array>
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string_view>
+#include <time.h>
+
+// 出错响应的状态行、Content-Type和Content-Length的最大长度
+#define ERROR_HEAD_SIZE 128
+// 出错响应的响应体的最大长度
+#define ERROR_BODY_SIZE 96
+// multipart/byteranges各部分之间的分隔符
+#define MULTIPART_BOUNDARY "3d6b6a416f9b5e1c"
+// "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n"的长度
+#define HTTP_DATE_LINE_SIZE 37
+// "Sun, 06 Nov 1994 08:49:37 GMT"加上\0
+#define HTTP_DATE_SIZE 30
+
+/// @brief 编译期拼接的定长字符串
+template <size_t N>
+struct fixed_string
+{
+    char m_data[N] = {};
+    size_t m_size = 0;
+
+    constexpr void append(std::string_view str)
+    {
+        for (size_t i = 0; i < str.size(); i++)
+        {
+            m_data[m_size++] = str[i];
+        }
+    }
+    constexpr void append_number(size_t n)
+    {
+        char digits[20] = {};
+        int len = 0;
+        do
+        {
+            digits[len++] = '0' + n % 10;
+            n /= 10;
+        } while (n > 0);
+        while (len > 0)
+        {
+            m_data[m_size++] = digits[--len];
+        }
+    }
+    constexpr std::string_view view() const { return std::string_view(m_data, m_size); }
+};
+
+/// @brief 每个状态码的状态行
+struct status_template
+{
+    HTTP_CODE m_code;
+    std::string_view m_line;
+};
+
+constexpr status_template STATUS_TEMPLATES[] = {
+    {HTTP_CODE::FILE_REQUEST, "HTTP/1.1 200 OK\r\n"},
+    {HTTP_CODE::PARTIAL_CONTENT, "HTTP/1.1 206 Partial Content\r\n"},
+    {HTTP_CODE::NOT_MODIFIED, "HTTP/1.1 304 Not Modified\r\n"},
+    {HTTP_CODE::BAD_REQUEST, "HTTP/1.1 400 Bad Request\r\n"},
+    {HTTP_CODE::FORBIDDEN_REQUEST, "HTTP/1.1 403 Forbidden\r\n"},
+    {HTTP_CODE::NO_RESOURCE, "HTTP/1.1 404 Not Found\r\n"},
+    {HTTP_CODE::RANGE_NOT_SATISFIABLE, "HTTP/1.1 416 Range Not Satisfiable\r\n"},
+    {HTTP_CODE::INTERNAL_ERROR, "HTTP/1.1 500 Internal Server Error\r\n"},
+};
+
+constexpr size_t STATUS_NUM = sizeof(STATUS_TEMPLATES) / sizeof(STATUS_TEMPLATES[0]);
+
+/// @brief 出错响应除了Date和Connection以外的部分，编译期生成
+struct error_template
+{
+    fixed_string<ERROR_HEAD_SIZE> m_head; // 状态行、Content-Type、Content-Length
+    fixed_string<ERROR_BODY_SIZE> m_body;
+};
+
+constexpr std::array<error_template, STATUS_NUM> make_error_templates()
+{
+    std::array<error_template, STATUS_NUM> templates = {};
+    for (size_t i = 0; i < STATUS_NUM; i++)
+    {
+        // 去掉"HTTP/1.1 "和"\r\n"就是"404 Not Found"
+        std::string_view reason = STATUS_TEMPLATES[i].m_line.substr(9);
+        reason.remove_suffix(2);
+        fixed_string<ERROR_BODY_SIZE> &body = templates[i].m_body;
+        body.append("<html><body><h1>");
+        body.append(reason);
+        body.append("</h1></body></html>\n");
+        fixed_string<ERROR_HEAD_SIZE> &head = templates[i].m_head;
+        head.append(STATUS_TEMPLATES[i].m_line);
+        head.append("Content-Type: text/html; charset=utf-8\r\nContent-Length: ");
+        head.append_number(body.m_size);
+        head.append("\r\n");
+    }
+    return templates;
+}
+
+constexpr std::array<error_template, STATUS_NUM> ERROR_TEMPLATES = make_error_templates();
+
+/**
+ * @brief 状态码在STATUS_TEMPLATES中的下标
+ *
+ * @param code
+ * @return int 不认识的状态码返回-1
+ */
+constexpr int find_status(HTTP_CODE code)
+{
+    for (size_t i = 0; i < STATUS_NUM; i++)
+    {
+        if (STATUS_TEMPLATES[i].m_code == code)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/// @brief 状态行，不认识的状态码返回空
+constexpr std::string_view status_line(HTTP_CODE code)
+{
+    int i = find_status(code);
+    return i < 0 ? std::string_view() : STATUS_TEMPLATES[i].m_line;
+}
+
+/// @brief 出错响应的状态行和响应头(不含Date、Connection和空行)，不认识的状态码返回空
+inline std::string_view error_head(HTTP_CODE code)
+{
+    int i = find_status(code);
+    return i < 0 ? std::string_view() : ERROR_TEMPLATES[i].m_head.view();
+}
+
+/// @brief 出错响应的响应体
+inline std::string_view error_body(HTTP_CODE code)
+{
+    int i = find_status(code);
+    return i < 0 ? std::string_view() : ERROR_TEMPLATES[i].m_body.view();
+}
+
+/// @brief 扩展名和完整的Content-Type响应头
+struct mime_type
+{
+    std::string_view m_ext;
+    std::string_view m_line;
+    bool m_compressible; // 文本类的内容，值得压缩
+};
+
+constexpr mime_type MIME_TYPES[] = {
+    {"html", "Content-Type: text/html; charset=utf-8\r\n", true},
+    {"htm", "Content-Type: text/html; charset=utf-8\r\n", true},
+    {"css", "Content-Type: text/css; charset=utf-8\r\n", true},
+    {"js", "Content-Type: text/javascript; charset=utf-8\r\n", true},
+    {"mjs", "Content-Type: text/javascript; charset=utf-8\r\n", true},
+    {"json", "Content-Type: application/json\r\n", true},
+    {"map", "Content-Type: application/json\r\n", true},
+    {"txt", "Content-Type: text/plain; charset=utf-8\r\n", true},
+    {"md", "Content-Type: text/markdown; charset=utf-8\r\n", true},
+    {"csv", "Content-Type: text/csv; charset=utf-8\r\n", true},
+    {"xml", "Content-Type: application/xml\r\n", true},
+    {"png", "Content-Type: image/png\r\n", false},
+    {"jpg", "Content-Type: image/jpeg\r\n", false},
+    {"jpeg", "Content-Type: image/jpeg\r\n", false},
+    {"gif", "Content-Type: image/gif\r\n", false},
+    {"webp", "Content-Type: image/webp\r\n", false},
+    {"avif", "Content-Type: image/avif\r\n", false},
+    {"svg", "Content-Type: image/svg+xml\r\n", true},
+    {"ico", "Content-Type: image/x-icon\r\n", false},
+    {"bmp", "Content-Type: image/bmp\r\n", false},
+    {"woff", "Content-Type: font/woff\r\n", false},
+    {"woff2", "Content-Type: font/woff2\r\n", false},
+    {"ttf", "Content-Type: font/ttf\r\n", false},
+    {"otf", "Content-Type: font/otf\r\n", false},
+    {"wasm", "Content-Type: application/wasm\r\n", true},
+    {"pdf", "Content-Type: application/pdf\r\n", false},
+    {"zip", "Content-Type: application/zip\r\n", false},
+    {"gz", "Content-Type: application/gzip\r\n", false},
+    {"tar", "Content-Type: application/x-tar\r\n", false},
+    {"mp3", "Content-Type: audio/mpeg\r\n", false},
+    {"ogg", "Content-Type: audio/ogg\r\n", false},
+    {"wav", "Content-Type: audio/wav\r\n", false},
+    {"mp4", "Content-Type: video/mp4\r\n", false},
+    {"webm", "Content-Type: video/webm\r\n", false},
+};
+
+constexpr size_t MIME_NUM = sizeof(MIME_TYPES) / sizeof(MIME_TYPES[0]);
+// 扩展名哈希表的槽位数(2的幂)，开放寻址
+#define MIME_HASH_SIZE 128
+// 没有扩展名或不认识的扩展名
+constexpr mime_type DEFAULT_MIME_TYPE = {"", "Content-Type: application/octet-stream\r\n", false};
+
+/// @brief 扩展名哈希表，槽位中是MIME_TYPES的下标加一，0表示空
+struct mime_hash_table
+{
+    uint8_t m_slots[MIME_HASH_SIZE];
+
+    constexpr mime_hash_table() : m_slots()
+    {
+        for (size_t i = 0; i < MIME_NUM; i++)
+        {
+            uint32_t slot = header_hash(MIME_TYPES[i].m_ext, HEADER_HASH_SEED) & (MIME_HASH_SIZE - 1);
+            while (m_slots[slot] != 0)
+            {
+                slot = (slot + 1) & (MIME_HASH_SIZE - 1);
+            }
+            m_slots[slot] = i + 1;
+        }
+    }
+};
+
+constexpr mime_hash_table MIME_TABLE;
+
+/**
+ * @brief 按文件扩展名查找类型，不区分大小写
+ *
+ * @param path 文件路径
+ * @return const mime_type& 不认识时返回DEFAULT_MIME_TYPE
+ */
+inline const mime_type &find_mime_type(std::string_view path)
+{
+    size_t dot = path.rfind('.');
+    if (dot == std::string_view::npos || path.find('/', dot) != std::string_view::npos)
+    {
+        return DEFAULT_MIME_TYPE;
+    }
+    std::string_view ext = path.substr(dot + 1);
+    uint32_t slot = header_hash(ext, HEADER_HASH_SEED) & (MIME_HASH_SIZE - 1);
+    while (MIME_TABLE.m_slots[slot] != 0)
+    {
+        const mime_type &type = MIME_TYPES[MIME_TABLE.m_slots[slot] - 1];
+        if (type.m_ext.size() == ext.size())
+        {
+            size_t i = 0;
+            while (i < ext.size() && (uint8_t)(ext[i] | 0x20) == (uint8_t)type.m_ext[i])
+            {
+                i++;
+            }
+            if (i == ext.size())
+            {
+                return type;
+            }
+        }
+        slot = (slot + 1) & (MIME_HASH_SIZE - 1);
+    }
+    return DEFAULT_MIME_TYPE;
+}
+
+/// @brief 文件的Content-Type响应头，带\r\n
+inline std::string_view content_type_line(std::string_view path)
+{
+    return find_mime_type(path).m_line;
+}
+
+/// @brief 压缩编码的名字、预压缩文件的后缀和Content-Encoding响应头
+struct encoding_type
+{
+    std::string_view m_name;
+    std::string_view m_suffix;
+    std::string_view m_line;
+};
+
+// 顺序和CONTENT_ENCODING一致
+constexpr encoding_type ENCODINGS[ENCODING_NUM] = {
+    {"br", ".br", "Content-Encoding: br\r\n"},
+    {"gzip", ".gz", "Content-Encoding: gzip\r\n"},
+};
+
+// 解析Accept-Encoding，返回客户端接受的压缩编码，第i位对应CONTENT_ENCODING中的i
+unsigned parse_accept_encoding(std::string_view value);
+
+/**
+ * @brief 十进制格式化
+ *
+ * @param buf 至少20字节
+ * @param n
+ * @return int 写入的字节数
+ */
+inline int format_decimal(char *buf, uint64_t n)
+{
+    char digits[20];
+    int len = 0;
+    do
+    {
+        digits[len++] = '0' + n % 10;
+        n /= 10;
+    } while (n > 0);
+    for (int i = 0; i < len; i++)
+    {
+        buf[i] = digits[len - 1 - i];
+    }
+    return len;
+}
+
+// 格式化成HTTP日期，buf至少HTTP_DATE_SIZE字节
+void format_http_date(time_t t, char *buf);
+// 解析HTTP日期(IMF-fixdate)，格式不对时返回-1
+time_t parse_http_date(std::string_view str);
+
+/**
+ * @brief 所有连接共用的Date响应头，每秒最多格式化一次
+ * 两块缓冲区轮流写，读的一方只复制当前那块，写的一方写另一块再切换
+ */
+class http_date
+{
+public:
+    // 秒数变了才重新格式化，事件循环每次醒来调用
+    static void update();
+    // 完整的"Date: ...\r\n"
+    static std::string_view get()
+    {
+        return std::string_view(m_lines[m_index.load(std::memory_order_acquire)], HTTP_DATE_LINE_SIZE);
+    }
+
+private:
+    // 留出余量，snprintf不会截断
+    static char m_lines[2][64];
+    static std::atomic<int> m_index;
+    static std::atomic<time_t> m_time;
+};
+
+#endif // !HTTP_RESPONSE_H
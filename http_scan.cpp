@@ -0,0 +1,113 @@
+#include "http_scan.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+typedef const char *(*scan_func)(const char *, const char *, char, char);
+
+const char *scan_any2_scalar(const char *begin, const char *end, char c1, char c2)
+{
+    while (begin < end && *begin != c1 && *begin != c2)
+    {
+        begin++;
+    }
+    return begin;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2"))) const char *scan_any2_sse2(const char *begin, const char *end, char c1, char c2)
+{
+    const __m128i v1 = _mm_set1_epi8(c1);
+    const __m128i v2 = _mm_set1_epi8(c2);
+    while (end - begin >= 16)
+    {
+        __m128i data = _mm_loadu_si128((const __m128i *)begin);
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(data, v1), _mm_cmpeq_epi8(data, v2));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask != 0)
+        {
+            return begin + __builtin_ctz(mask);
+        }
+        begin += 16;
+    }
+    // 不足16字节的尾部
+    return scan_any2_scalar(begin, end, c1, c2);
+}
+
+__attribute__((target("avx2"))) const char *scan_any2_avx2(const char *begin, const char *end, char c1, char c2)
+{
+    const __m256i v1 = _mm256_set1_epi8(c1);
+    const __m256i v2 = _mm256_set1_epi8(c2);
+    while (end - begin >= 32)
+    {
+        __m256i data = _mm256_loadu_si256((const __m256i *)begin);
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(data, v1), _mm256_cmpeq_epi8(data, v2));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+        if (mask != 0)
+        {
+            return begin + __builtin_ctz(mask);
+        }
+        begin += 32;
+    }
+    // 尾部也在本函数里处理，避免调用非VEX编码的SSE代码带来的状态切换开销
+    if (end - begin >= 16)
+    {
+        __m128i data = _mm_loadu_si128((const __m128i *)begin);
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(data, _mm256_castsi256_si128(v1)), _mm_cmpeq_epi8(data, _mm256_castsi256_si128(v2)));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask != 0)
+        {
+            return begin + __builtin_ctz(mask);
+        }
+        begin += 16;
+    }
+    while (begin < end && *begin != c1 && *begin != c2)
+    {
+        begin++;
+    }
+    return begin;
+}
+#endif
+
+/**
+ * @brief 启动时选择当前CPU支持的最快实现
+ *
+ * @param name 选中实现的名字
+ * @return scan_func
+ */
+static scan_func select_scan(const char *&name)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        name = "avx2";
+        return scan_any2_avx2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        name = "sse2";
+        return scan_any2_sse2;
+    }
+#endif
+    name = "scalar";
+    return scan_any2_scalar;
+}
+
+static const char *scan_name = "scalar";
+static const scan_func scan_impl = select_scan(scan_name);
+
+const char *scan_any2(const char *begin, const char *end, char c1, char c2)
+{
+    // 短数据直接逐字节比较，省掉间接调用
+    if (end - begin < 16)
+    {
+        return scan_any2_scalar(begin, end, c1, c2);
+    }
+    return scan_impl(begin, end, c1, c2);
+}
+
+const char *scan_impl_name()
+{
+    return scan_name;
+}
@@ -0,0 +1,33 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+#include <stddef.h>
+
+/**
+ * @brief 查找[begin, end)中第一个等于c1或c2的字节，没有时返回end
+ * 运行时按CPU选择AVX2(每次32字节)、SSE2(每次16字节)或逐字节实现
+ */
+const char *scan_any2(const char *begin, const char *end, char c1, char c2);
+
+/// @brief 查找第一个\r或\n
+inline const char *scan_crlf(const char *begin, const char *end)
+{
+    return scan_any2(begin, end, '\r', '\n');
+}
+
+/// @brief 查找第一个等于c的字节
+inline const char *scan_char(const char *begin, const char *end, char c)
+{
+    return scan_any2(begin, end, c, c);
+}
+
+// 各个实现，供测试对比
+const char *scan_any2_scalar(const char *begin, const char *end, char c1, char c2);
+#if defined(__x86_64__) || defined(__i386__)
+const char *scan_any2_sse2(const char *begin, const char *end, char c1, char c2);
+const char *scan_any2_avx2(const char *begin, const char *end, char c1, char c2);
+#endif
+// 当前选中的实现名字
+const char *scan_impl_name();
+
+#endif // !HTTP_SCAN_H
@@ -4,6 +4,11 @@
 #include <pthread.h>
 #include <exception>
 #include <semaphore.h>
+#include <atomic>
+#include <climits>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 // 线程锁类
 class locker
 {
@@ -21,7 +26,7 @@ public:
     pthread_mutex_t *get_lock();
 };
 
-locker::locker()
+inline locker::locker()
 {
     if (pthread_mutex_init(&m_mutex, NULL) != 0)
     {
@@ -29,22 +34,22 @@ locker::locker()
     }
 }
 
-locker::~locker()
+inline locker::~locker()
 {
     pthread_mutex_destroy(&m_mutex);
 }
 
-bool locker::lock()
+inline bool locker::lock()
 {
     return pthread_mutex_lock(&m_mutex) == 0;
 }
 
-bool locker::unlock()
+inline bool locker::unlock()
 {
     return pthread_mutex_unlock(&m_mutex) == 0;
 }
 
-pthread_mutex_t *locker::get_lock()
+inline pthread_mutex_t *locker::get_lock()
 {
     return &m_mutex;
 }
@@ -59,10 +64,10 @@ public:
     ~cond();
     bool wait(pthread_mutex_t *mutex);
     bool timewait(pthread_mutex_t *mutex, timespec tmspc);
-    // bool signal();
-    // bool broadcast();
+    bool signal();
+    bool broadcast();
 };
-cond::cond()
+inline cond::cond()
 {
     if (pthread_cond_init(&m_cond, NULL))
     {
@@ -70,21 +75,31 @@ cond::cond()
     }
 }
 
-cond::~cond()
+inline cond::~cond()
 {
     pthread_cond_destroy(&m_cond);
 }
 
-bool cond::wait(pthread_mutex_t *mutex)
+inline bool cond::wait(pthread_mutex_t *mutex)
 {
     return pthread_cond_wait(&m_cond, mutex) == 0;
 }
 
-bool cond::timewait(pthread_mutex_t *mutex, timespec tmspc)
+inline bool cond::timewait(pthread_mutex_t *mutex, timespec tmspc)
 {
     return pthread_cond_timedwait(&m_cond, mutex, &tmspc) == 0;
 }
 
+inline bool cond::signal()
+{
+    return pthread_cond_signal(&m_cond) == 0;
+}
+
+inline bool cond::broadcast()
+{
+    return pthread_cond_broadcast(&m_cond) == 0;
+}
+
 // 信号量类
 class sem
 {
@@ -101,7 +116,7 @@ public:
     bool post();
 };
 
-sem::sem()
+inline sem::sem()
 {
     if (sem_init(&m_sem, 0, 0))
     {
@@ -109,25 +124,92 @@ sem::sem()
     }
 }
 
-sem::sem(int num)
+inline sem::sem(int num)
 {
     if (sem_init(&m_sem, 0, num))
     {
         throw std::exception();
     }
 }
-sem::~sem()
+inline sem::~sem()
 {
     sem_destroy(&m_sem);
 }
 // 等待信号量
-bool sem::wait()
+inline bool sem::wait()
 {
     return sem_wait(&m_sem) == 0;
 }
 // 增加信号量
-bool sem::post()
+inline bool sem::post()
 {
     return sem_post(&m_sem) == 0;
 }
-#endif
\ No newline at end of file
+
+// 事件计数器(eventcount)，配合无锁队列使用：没有线程在等待时notify不进入内核
+class event_count
+{
+private:
+    // futex等待的字，每次notify加一
+    std::atomic<int> m_epoch;
+    // 正在等待或准备等待的线程数
+    std::atomic<int> m_waiters;
+
+public:
+    event_count() : m_epoch(0), m_waiters(0) {}
+    // 准备等待，返回之后需要再检查一次条件，条件仍不满足才wait
+    int prepare_wait();
+    // 条件已经满足，取消等待
+    void cancel_wait();
+    // 等待prepare_wait之后的notify
+    void wait(int key);
+    // 唤醒一个等待线程
+    void notify();
+    // 唤醒所有等待线程
+    void notify_all();
+};
+
+inline int event_count::prepare_wait()
+{
+    m_waiters.fetch_add(1, std::memory_order_seq_cst);
+    return m_epoch.load(std::memory_order_seq_cst);
+}
+
+inline void event_count::cancel_wait()
+{
+    m_waiters.fetch_sub(1, std::memory_order_relaxed);
+}
+
+inline void event_count::wait(int key)
+{
+    // epoch已经变化说明错过的notify已经发生，futex会立即返回
+    while (m_epoch.load(std::memory_order_acquire) == key)
+    {
+        syscall(SYS_futex, (int *)&m_epoch, FUTEX_WAIT_PRIVATE, key, NULL, NULL, 0);
+    }
+    m_waiters.fetch_sub(1, std::memory_order_relaxed);
+}
+
+inline void event_count::notify()
+{
+    // 和prepare_wait里的fetch_add配对，保证生产者要么看到等待者，要么等待者看到新数据
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_waiters.load(std::memory_order_relaxed) == 0)
+    {
+        return;
+    }
+    m_epoch.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, (int *)&m_epoch, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+inline void event_count::notify_all()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_waiters.load(std::memory_order_relaxed) == 0)
+    {
+        return;
+    }
+    m_epoch.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, (int *)&m_epoch, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+#endif
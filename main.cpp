@@ -1,35 +1,31 @@
 #include "http_conn.h"
 #include "threadpool.h"
 #include "conn_timer.h"
+#include "event_loop.h"
+#include "uring_loop.h"
+#include "file_cache.h"
+#include "compress_cache.h"
+#include "bundle.h"
+#include "prefetcher.h"
+#include "http_response.h"
 #include <arpa/inet.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
-#include <sys/epoll.h>
 #include <signal.h>
 #include <time.h>
+#include <vector>
 
-extern conn_timer_list TIMER_LIST;
-extern int pipefd[2];
-#define MAX_USER_NUM 65534
-#define MAX_EVENT_NUM 10000
-epoll_event events[MAX_USER_NUM];
-http_conn *users = new http_conn[MAX_USER_NUM];
+conn_table *conns = new conn_table(MAX_USER_NUM);
 
-int http_conn::m_user_num = 0;
-int http_conn::m_epoll_fd = -1;
+std::atomic<int> http_conn::m_user_num(0);
+bool http_conn::m_use_sendfile = false;
+file_cache *http_conn::m_file_cache = NULL;
+bool http_conn::m_dir_listing = false;
+compress_cache *http_conn::m_compress_cache = NULL;
+bundle *http_conn::m_bundle = NULL;
+prefetcher *http_conn::m_prefetcher = NULL;
 
-static bool timeout = false;
-bool server_stop = false;
-void timer_handler()
-{
-    TIMER_LIST.address_expired();
-    alarm(TIMER_SLOT);
-}
-void sig_handler(int num)
-{
-    send(pipefd[1], (char *)&num, 1, 0);
-}
 /**
  * @brief 添加信号
  *
@@ -44,185 +40,256 @@ void add_sigaction(int signum, void(handler)(int))
     sigfillset(&sa.sa_mask);
     sigaction(signum, &sa, NULL);
 }
-int main(int argc, const char *argv[])
+
+/**
+ * @brief 停止并释放所有事件循环
+ *
+ * @param loops
+ */
+template <typename LOOP>
+void server_stop(std::vector<LOOP *> &loops)
 {
-    if (argc <= 1)
+    for (size_t i = 0; i < loops.size(); i++)
     {
-        printf("请指定端口号\n");
-        return -1;
+        loops[i]->stop();
     }
-    threadpool<http_conn> *pool = NULL;
-
-    try
+    for (size_t i = 0; i < loops.size(); i++)
     {
-        pool = new threadpool<http_conn>;
+        loops[i]->join();
+        delete loops[i];
     }
-    catch (const std::exception &e)
+    loops.clear();
+}
+
+/**
+ * @brief 创建并启动loop_num个事件循环
+ *
+ * @param loops 启动成功的事件循环
+ * @return true 全部启动成功
+ * @return false 有事件循环启动失败，已经启动的会被停止
+ */
+template <typename LOOP, typename... ARGS>
+bool server_start(std::vector<LOOP *> &loops, int loop_num, ARGS... args)
+{
+    for (int i = 0; i < loop_num; i++)
     {
-        std::cerr << e.what() << '\n';
-        printf("线程池创建失败\n");
-        return -1;
+        LOOP *loop = new LOOP(args...);
+        loops.push_back(loop);
+        if (!loop->init() || !loop->start())
+        {
+            printf("事件循环%d启动失败\n", i);
+            server_stop(loops);
+            return false;
+        }
+        printf("event loop %d is running\n", i);
     }
+    return true;
+}
 
-    add_sigaction(SIGPIPE, SIG_IGN);
+void usage(const char *name)
+{
+    printf("用法: %s <端口号> [-r 事件循环数量] [-u] [-t 线程数] [-w] [-a] [-s] [-c 响应缓存文件大小] [-l] [-z] [-b 打包文件] [-n]\n", name);
+    printf("  -r n  多reactor模式，n个事件循环线程各自accept、读写并处理请求\n");
+    printf("  -u    使用io_uring代替epoll，内核不支持时回退到epoll\n");
+    printf("  -t n  线程池线程数，默认等于CPU核数\n");
+    printf("  -w    线程池使用工作窃取，每个线程一个本地队列\n");
+    printf("  -a    线程池线程绑定CPU\n");
+    printf("  -s    用sendfile发送文件，不再mmap\n");
+    printf("  -c n  缓存不超过n KB的文件的完整响应，默认%d，0表示不缓存\n", FILE_CACHE_RESPONSE_FILE_SIZE / 1024);
+    printf("  -l    请求目录时返回目录列表\n");
+    printf("  -z    没有预压缩文件时不在后台压缩\n");
+    printf("  -b f  从bundle_pack生成的打包文件返回所有文件，不再访问根目录\n");
+    printf("  -n    发送前不检查文件内容是否在页缓存中，冷文件由事件循环线程直接读磁盘\n");
+}
 
-    // 申请用于监听的文件描述符
-    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-    printf("listen_fd = %d\n", listen_fd);
-    if (listen_fd == -1)
+int main(int argc, char *argv[])
+{
+    if (argc <= 1)
     {
-        perror("listen");
-        delete[] events;
+        printf("请指定端口号\n");
+        usage(argv[0]);
         return -1;
     }
-
     int port = atoi(argv[1]);
     printf("port = %d\n", port);
 
-    // 设置端口复用
-    int opt = 1;
-    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
-
-    sockaddr_in server_addr;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    // char *sip = "127.0.0.1";
-    // inet_pton(AF_INET, sip, &server_addr.sin_addr.s_addr);
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(port);
-
-    int res = bind(listen_fd, (sockaddr *)&server_addr, sizeof(server_addr));
-    if (res == -1)
+    // 0表示单reactor模式：一个事件循环负责IO，线程池负责解析
+    int loop_num = 0;
+    bool use_uring = false;
+    int thread_num = 0;
+    bool work_stealing = false;
+    bool pin_cpu = false;
+    size_t response_file_size = FILE_CACHE_RESPONSE_FILE_SIZE;
+    bool compress = true;
+    const char *bundle_path = NULL;
+    bool prefetch = true;
+    int opt;
+    // 跳过端口号，argv[1]被getopt当作程序名
+    while ((opt = getopt(argc - 1, argv + 1, "r:ut:wasc:lzb:n")) != -1)
     {
-        perror("bind");
-        close(listen_fd);
-        delete[] events;
-        return -1;
+        switch (opt)
+        {
+        case 'r':
+            loop_num = atoi(optarg);
+            break;
+        case 'u':
+            use_uring = true;
+            break;
+        case 't':
+            thread_num = atoi(optarg);
+            break;
+        case 'w':
+            work_stealing = true;
+            break;
+        case 'a':
+            pin_cpu = true;
+            break;
+        case 's':
+            http_conn::m_use_sendfile = true;
+            break;
+        case 'c':
+            response_file_size = (size_t)atoi(optarg) * 1024;
+            break;
+        case 'l':
+            http_conn::m_dir_listing = true;
+            break;
+        case 'z':
+            compress = false;
+            break;
+        case 'b':
+            bundle_path = optarg;
+            break;
+        case 'n':
+            prefetch = false;
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
     }
 
-    // 监听
-    listen(listen_fd, 10);
+    threadpool<http_conn> *pool = NULL;
+    // io_uring后端总是在循环线程中处理请求
+    if (loop_num <= 0 && !use_uring)
+    {
+        try
+        {
+            pool = new threadpool<http_conn>(thread_num, 10000, work_stealing, pin_cpu);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << '\n';
+            printf("线程池创建失败\n");
+            return -1;
+        }
+    }
+    if (loop_num <= 0)
+    {
+        loop_num = 1;
+    }
 
-    // 创建epoll
-    int epoll_fd = epoll_create(MAX_USER_NUM);
-    http_conn::m_epoll_fd = epoll_fd;
-    printf("epoll_fd = %d\n", epoll_fd);
+    add_sigaction(SIGPIPE, SIG_IGN);
 
-    // 监听描述符不应该oneshot
-    epoll_add(epoll_fd, listen_fd, false);
-    // 创建管道
-    res = socketpair(AF_INET, SOCK_STREAM, 0, pipefd);
-    if (res == -1)
+    http_date::update();
+    if (bundle_path != NULL)
     {
-        perror("socketpair");
-        close(listen_fd);
-        close(epoll_fd);
-        delete[] events;
-        return -1;
+        // 打包文件中的响应都是生成好的，不需要文件缓存和压缩缓存
+        http_conn::m_bundle = new bundle;
+        if (!http_conn::m_bundle->open(bundle_path))
+        {
+            printf("打包文件%s无法使用\n", bundle_path);
+            delete http_conn::m_bundle;
+            delete pool;
+            return -1;
+        }
+        printf("打包文件%s: %u个文件\n", bundle_path, http_conn::m_bundle->size());
     }
-    epoll_add(epoll_fd, pipefd[0], false);
-    add_sigaction(SIGALRM, sig_handler);
-    alarm(TIMER_SLOT);
-
-    while (!server_stop)
+    else
     {
-        int num = epoll_wait(epoll_fd, events, MAX_EVENT_NUM, -1);
-        if (num == -1 && errno != EINTR)
+        http_conn::m_file_cache =
+            new file_cache(ROOT_PATH, FILE_CACHE_MAX_ENTRIES, FILE_CACHE_MAX_BYTES, response_file_size);
+        if (!http_conn::m_file_cache->start())
         {
-            printf("epoll failure\n");
-            break;
+            printf("inotify不可用，不缓存打开的文件\n");
         }
-
-        for (int i = 0; i < num; i++)
+    }
+    if (compress && http_conn::m_file_cache != NULL)
+    {
+        http_conn::m_compress_cache = new compress_cache(http_conn::m_file_cache);
+        if (!http_conn::m_compress_cache->start())
         {
-            int fd = events[i].data.fd;
-            printf("请求fd = %d\n", fd);
-
-            // 有新的连接
-            if (fd == listen_fd)
-            {
-                sockaddr_in addr;
-                socklen_t size = sizeof(addr);
-                int sockfd = accept(listen_fd, (sockaddr *)&addr, &size);
-                if (http_conn::m_user_num > MAX_USER_NUM)
-                {
-                    // 可以给客户端提示
-                    printf("服务器正忙\n");
-                    close(sockfd);
-                    continue;
-                }
-
-                // 记录新的连接信息
-                users[sockfd].init(sockfd, addr);
-                conn_timer *timer = new conn_timer(&users[sockfd]);
-                TIMER_LIST.append(timer);
-                users[sockfd].set_timer(timer);
-            }
-            else if (fd == pipefd[0])
-            {
-                char buf[1024];
-                int len = recv(pipefd[0], buf, 1024, 0);
-                for (int i = 0; i < len; i++)
-                {
-                    if (buf[i] == SIGALRM)
-                    {
-                        timeout = true;
-                    }
-                    else if (buf[i] == SIGTERM)
-                    {
-                        server_stop = true;
-                    }
-                }
-            }
-            else if (events[i].events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR))
-            {
-                // 客户端断开或错误
-                users[fd].close_conn();
-            }
-            else if (events[i].events & EPOLLIN)
-            {
-
-                // 检测到读事件
-                if (users[fd].read())
-                {
-                    // 一次性读完数据
-                    pool->append(users + fd);
-                    conn_timer *timer = users[fd].get_timer();
-                    // 默认更新15s
-                    TIMER_LIST.adjust_timer(timer);
-                }
-                else
-                {
-                    // read失败
-                    users[fd].close_conn();
-                }
-            }
-            else if (events[i].events & EPOLLOUT)
-            {
-                // 检测到写事件
-                if (users[fd].write())
-                {
-                    conn_timer *timer = users[fd].get_timer();
-                    // 默认更新15s
-                    TIMER_LIST.adjust_timer(timer);
-                }
-                else
-                {
-                    // 写失败
-                    users[fd].close_conn();
-                }
-            }
+            printf("压缩线程创建失败，不压缩\n");
+            delete http_conn::m_compress_cache;
+            http_conn::m_compress_cache = NULL;
         }
-        if (timeout)
+    }
+
+    if (prefetch)
+    {
+        http_conn::m_prefetcher = new prefetcher;
+        if (!http_conn::m_prefetcher->start())
         {
-            timer_handler();
-            timeout = false;
+            printf("预读线程创建失败，不检查页缓存\n");
+            delete http_conn::m_prefetcher;
+            http_conn::m_prefetcher = NULL;
         }
     }
 
-    close(epoll_fd);
-    close(listen_fd);
-    delete[] events;
-    delete[] users;
+    // 事件循环线程不处理退出信号，统一由主线程sigwait
+    sigset_t stop_set;
+    sigemptyset(&stop_set);
+    sigaddset(&stop_set, SIGTERM);
+    sigaddset(&stop_set, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &stop_set, NULL);
+
+    std::vector<event_loop *> loops;
+    std::vector<uring_loop *> uring_loops;
+    if (use_uring && !server_start(uring_loops, loop_num, port))
+    {
+        printf("io_uring不可用，回退到epoll\n");
+        use_uring = false;
+    }
+    if (!use_uring && !server_start(loops, loop_num, port, pool))
+    {
+        delete http_conn::m_compress_cache;
+        delete http_conn::m_file_cache;
+        delete http_conn::m_prefetcher;
+        delete http_conn::m_bundle;
+        delete pool;
+        return -1;
+    }
+
+    int signum;
+    sigwait(&stop_set, &signum);
+    printf("收到信号%d，服务器退出\n", signum);
+
+    // 预读线程会往事件循环的队列里放完成的连接，先停
+    if (http_conn::m_prefetcher != NULL)
+    {
+        http_conn::m_prefetcher->stop();
+    }
+
+    server_stop(uring_loops);
+    server_stop(loops);
+    // 工作线程可能还在处理连接，先停线程池再释放连接表
     delete pool;
+    if (http_conn::m_prefetcher != NULL)
+    {
+        http_conn::m_prefetcher->print_stats();
+        delete http_conn::m_prefetcher;
+    }
+    delete conns;
+    // 压缩缓存的后台任务持有文件缓存中的文件，先释放
+    if (http_conn::m_compress_cache != NULL)
+    {
+        http_conn::m_compress_cache->print_stats();
+        delete http_conn::m_compress_cache;
+    }
+    if (http_conn::m_file_cache != NULL)
+    {
+        http_conn::m_file_cache->print_stats();
+        delete http_conn::m_file_cache;
+    }
+    delete http_conn::m_bundle;
     return 0;
 }
@@ -0,0 +1,152 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+#include <exception>
+#include <stddef.h>
+
+#define CACHE_LINE_SIZE 64
+
+/**
+ * @brief 有界多生产者多消费者无锁环形队列
+ * 每个格子带一个序号，生产者/消费者用CAS抢占入队/出队位置，再用序号交接格子。
+ * 入队和出队位置各占一个缓存行，避免生产者和消费者互相伪共享。
+ *
+ * @tparam T 元素类型，需要可以拷贝
+ */
+template <typename T>
+class mpmc_queue
+{
+public:
+    // capacity会向上取整为2的幂
+    mpmc_queue(size_t capacity);
+    ~mpmc_queue();
+    // 入队，队列满时返回false
+    bool push(const T &data);
+    // 出队，队列空时返回false
+    bool pop(T &data);
+    // 近似的元素个数
+    size_t size() const;
+    size_t capacity() const { return m_mask + 1; }
+
+private:
+    struct cell
+    {
+        std::atomic<size_t> m_sequence;
+        T m_data;
+    };
+
+    alignas(CACHE_LINE_SIZE) cell *m_buffer;
+    size_t m_mask;
+    // 下一个入队位置
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_enqueue_pos;
+    // 下一个出队位置
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_dequeue_pos;
+    char m_pad[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+
+    mpmc_queue(const mpmc_queue &);
+    mpmc_queue &operator=(const mpmc_queue &);
+};
+
+template <typename T>
+mpmc_queue<T>::mpmc_queue(size_t capacity) : m_buffer(NULL), m_mask(0), m_enqueue_pos(0), m_dequeue_pos(0)
+{
+    if (capacity < 2)
+    {
+        capacity = 2;
+    }
+    size_t size = 1;
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+    m_buffer = new cell[size];
+    m_mask = size - 1;
+    for (size_t i = 0; i < size; i++)
+    {
+        m_buffer[i].m_sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+template <typename T>
+mpmc_queue<T>::~mpmc_queue()
+{
+    delete[] m_buffer;
+}
+
+template <typename T>
+bool mpmc_queue<T>::push(const T &data)
+{
+    cell *c;
+    size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    while (true)
+    {
+        c = &m_buffer[pos & m_mask];
+        size_t seq = c->m_sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0)
+        {
+            // 格子空闲，抢占这个位置
+            if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            // 消费者还没取走上一圈的数据，队列满
+            return false;
+        }
+        else
+        {
+            // 被其他生产者抢先了
+            pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    c->m_data = data;
+    c->m_sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+bool mpmc_queue<T>::pop(T &data)
+{
+    cell *c;
+    size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+    while (true)
+    {
+        c = &m_buffer[pos & m_mask];
+        size_t seq = c->m_sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0)
+        {
+            if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            // 队列空
+            return false;
+        }
+        else
+        {
+            pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    data = c->m_data;
+    // 格子留给下一圈的生产者
+    c->m_sequence.store(pos + m_mask + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+size_t mpmc_queue<T>::size() const
+{
+    size_t enqueue = m_enqueue_pos.load(std::memory_order_relaxed);
+    size_t dequeue = m_dequeue_pos.load(std::memory_order_relaxed);
+    return enqueue >= dequeue ? enqueue - dequeue : 0;
+}
+
+#endif // !MPMC_QUEUE_H
@@ -0,0 +1,239 @@
+#include "prefetcher.h"
+#include <errno.h>
+#include <stdio.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static const size_t page_size = sysconf(_SC_PAGESIZE);
+
+void prefetch_done_queue::push(uint64_t handle, bool ok)
+{
+    m_locker.lock();
+    m_results.push_back({handle, ok});
+    m_locker.unlock();
+    eventfd_write(m_wakeup_fd, 1);
+}
+
+void prefetch_done_queue::take(std::vector<result> &results)
+{
+    results.clear();
+    m_locker.lock();
+    m_results.swap(results);
+    m_locker.unlock();
+}
+
+prefetcher::prefetcher(int thread_num)
+    : m_thread_num(thread_num), m_submitted(0), m_rejected(0), m_stop(false)
+{
+    // 老内核没有MADV_POPULATE_READ，预读线程没办法等映射的页读完，这时不检查映射的数据
+    void *page = mmap(NULL, page_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    m_populate = page != MAP_FAILED && madvise(page, page_size, MADV_POPULATE_READ) == 0;
+    if (page != MAP_FAILED)
+    {
+        munmap(page, page_size);
+    }
+}
+
+prefetcher::~prefetcher()
+{
+    stop();
+}
+
+bool prefetcher::start()
+{
+    for (int i = 0; i < m_thread_num; i++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker, this) != 0)
+        {
+            stop();
+            return false;
+        }
+        m_threads.push_back(thread);
+    }
+    return true;
+}
+
+void prefetcher::stop()
+{
+    m_locker.lock();
+    m_stop = true;
+    m_cond.broadcast();
+    m_locker.unlock();
+    for (pthread_t thread : m_threads)
+    {
+        pthread_join(thread, NULL);
+    }
+    m_threads.clear();
+}
+
+void *prefetcher::worker(void *arg)
+{
+    prefetcher *p = (prefetcher *)arg;
+    p->run();
+    return p;
+}
+
+/**
+ * @brief 预读线程，一次预读一段，预读完让连接所在的事件循环接着发送。
+ * 读失败时也要通知，连接下次发送时不再检查，否则每次唤醒都会重新提交同一段
+ *
+ */
+void prefetcher::run()
+{
+    char *buf = NULL;
+    while (true)
+    {
+        m_locker.lock();
+        while (m_jobs.empty() && !m_stop)
+        {
+            m_cond.wait(m_locker.get_lock());
+        }
+        if (m_stop)
+        {
+            m_locker.unlock();
+            break;
+        }
+        job j = m_jobs.front();
+        m_jobs.pop_front();
+        m_locker.unlock();
+
+        bool ok = true;
+        if (j.m_addr != NULL)
+        {
+            // 映射在预读期间被解除时返回ENOMEM，文件被截断时返回EFAULT，不会访问无效的地址
+            uintptr_t start = (uintptr_t)j.m_addr & ~(page_size - 1);
+            int ret;
+            do
+            {
+                ret = madvise((void *)start, (uintptr_t)j.m_addr + j.m_len - start, MADV_POPULATE_READ);
+            } while (ret == -1 && errno == EINTR);
+            ok = ret == 0;
+        }
+        else
+        {
+            // 读到页缓存中，内容不要。fd在预读期间被关闭时读失败，没有影响
+            if (buf == NULL)
+            {
+                buf = new char[PREFETCH_WINDOW];
+            }
+            size_t done = 0;
+            while (done < j.m_len)
+            {
+                ssize_t n = pread(j.m_fd, buf, std::min(j.m_len - done, (size_t)PREFETCH_WINDOW), j.m_offset + done);
+                if (n == -1 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (n <= 0)
+                {
+                    break;
+                }
+                done += n;
+            }
+            // 读到文件末尾说明文件被截断了
+            ok = done == j.m_len;
+        }
+        j.m_done->push(j.m_handle, ok);
+    }
+    delete[] buf;
+}
+
+/**
+ * @brief 用mincore检查映射的页，地址不是文件映射(堆上的数据)时总是在内存中
+ *
+ * @param addr
+ * @param len
+ */
+bool prefetcher::resident(const void *addr, size_t len)
+{
+    if (!m_populate)
+    {
+        return true;
+    }
+    uintptr_t start = (uintptr_t)addr & ~(page_size - 1);
+    uintptr_t end = (uintptr_t)addr + len;
+    unsigned char vec[256];
+    while (start < end)
+    {
+        size_t pages = std::min((end - start + page_size - 1) / page_size, sizeof(vec));
+        if (mincore((void *)start, pages * page_size, vec) == -1)
+        {
+            return true;
+        }
+        for (size_t i = 0; i < pages; i++)
+        {
+            if (!(vec[i] & 1))
+            {
+                return false;
+            }
+        }
+        start += pages * page_size;
+    }
+    return true;
+}
+
+/**
+ * @brief 用RWF_NOWAIT读一个字节，不在页缓存中时返回EAGAIN而不是等磁盘。
+ * 文件一般是顺序读进来的，首尾两页都在时认为中间也在
+ *
+ * @param fd
+ * @param offset
+ * @param len
+ */
+bool prefetcher::resident(int fd, off_t offset, size_t len)
+{
+    if (len == 0)
+    {
+        return true;
+    }
+    char c;
+    struct iovec iov = {&c, 1};
+    if (preadv2(fd, &iov, 1, offset, RWF_NOWAIT) == -1 && errno == EAGAIN)
+    {
+        return false;
+    }
+    off_t last = offset + len - 1;
+    if ((size_t)last / page_size != (size_t)offset / page_size &&
+        preadv2(fd, &iov, 1, last, RWF_NOWAIT) == -1 && errno == EAGAIN)
+    {
+        return false;
+    }
+    return true;
+}
+
+bool prefetcher::submit(prefetch_done_queue *done, uint64_t handle, const void *addr, size_t len)
+{
+    return push({done, handle, (const char *)addr, -1, 0, len});
+}
+
+bool prefetcher::submit(prefetch_done_queue *done, uint64_t handle, int fd, off_t offset, size_t len)
+{
+    return push({done, handle, NULL, fd, offset, len});
+}
+
+bool prefetcher::push(const job &j)
+{
+    m_locker.lock();
+    // 停止后不再接受，事件循环退出前预读线程已经不会再访问它的队列
+    if (m_stop || m_jobs.size() >= PREFETCH_QUEUE_SIZE)
+    {
+        m_rejected++;
+        m_locker.unlock();
+        return false;
+    }
+    m_jobs.push_back(j);
+    m_submitted++;
+    m_cond.signal();
+    m_locker.unlock();
+    return true;
+}
+
+void prefetcher::print_stats()
+{
+    m_locker.lock();
+    printf("预读: %ld次, 队列满%ld次\n", m_submitted, m_rejected);
+    m_locker.unlock();
+}
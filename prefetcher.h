@@ -0,0 +1,99 @@
+#ifndef PREFETCHER_H
+#define PREFETCHER_H
+
+#include "locker.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <deque>
+#include <vector>
+
+// 预读线程数。预读时线程阻塞在磁盘上，不占CPU
+#define PREFETCH_THREAD_NUM 4
+// 每次发送前检查的字节数，和socket发送缓冲区差不多，后面的部分下次发送前再检查
+#define PREFETCH_WINDOW (1024 * 1024)
+// 排队的预读任务数上限，满了之后直接发送，由发送的线程自己等磁盘
+#define PREFETCH_QUEUE_SIZE 1024
+
+/**
+ * @brief 预读完成的连接
+ * 预读线程放入后写eventfd唤醒连接所属的事件循环，由事件循环线程查连接表确认连接还在，再接着发送。
+ * 查连接表和修改epoll都在事件循环线程中，连接在预读期间关闭、fd被新连接复用时不会注册错
+ */
+class prefetch_done_queue
+{
+public:
+    struct result
+    {
+        uint64_t m_handle;
+        bool m_ok; // 预读失败(文件被截断、映射被解除)时为false
+    };
+
+    prefetch_done_queue() : m_wakeup_fd(-1) {}
+    // 事件循环的eventfd，创建后设置
+    void set_wakeup_fd(int fd) { m_wakeup_fd = fd; }
+    // 预读线程调用
+    void push(uint64_t handle, bool ok);
+    // 事件循环线程调用，取出所有完成的连接
+    void take(std::vector<result> &results);
+
+private:
+    int m_wakeup_fd;
+    locker m_locker;
+    std::vector<result> m_results;
+};
+
+/**
+ * @brief 冷数据的预读阶段
+ * 事件循环线程发送文件内容前，先用mincore(映射的文件)或preadv2(RWF_NOWAIT)(sendfile的文件)检查是否在页缓存中，
+ * 在的话照常发送，只多一次系统调用；不在的话把这段数据交给预读线程，事件循环接着处理其他连接。
+ * 预读线程用MADV_POPULATE_READ或pread把数据读进页缓存后，把连接句柄放回所属事件循环的prefetch_done_queue。
+ * 预读任务只记录地址、fd和连接句柄，不访问连接和epoll
+ */
+class prefetcher
+{
+public:
+    prefetcher(int thread_num = PREFETCH_THREAD_NUM);
+    ~prefetcher();
+    bool start();
+    void stop();
+
+    // 映射的[addr, addr + len)是否都在页缓存中，内核不支持MADV_POPULATE_READ时总是返回true
+    bool resident(const void *addr, size_t len);
+    // 文件的[offset, offset + len)是否在页缓存中，只检查首尾两页
+    bool resident(int fd, off_t offset, size_t len);
+    // 预读映射的数据，完成后把handle放入done。队列满或已经停止时返回false
+    bool submit(prefetch_done_queue *done, uint64_t handle, const void *addr, size_t len);
+    // 预读文件的数据
+    bool submit(prefetch_done_queue *done, uint64_t handle, int fd, off_t offset, size_t len);
+    // 打印预读统计
+    void print_stats();
+
+private:
+    struct job
+    {
+        prefetch_done_queue *m_done;
+        uint64_t m_handle;
+        const char *m_addr; // 映射的数据，为NULL时预读m_fd
+        int m_fd;
+        off_t m_offset;
+        size_t m_len;
+    };
+
+    int m_thread_num;
+    std::vector<pthread_t> m_threads;
+    locker m_locker;
+    cond m_cond;
+    std::deque<job> m_jobs;
+    bool m_populate; // 内核支持MADV_POPULATE_READ
+    long m_submitted;
+    long m_rejected;
+    bool m_stop;
+
+private:
+    static void *worker(void *arg);
+    void run();
+    bool push(const job &j);
+};
+
+#endif // !PREFETCHER_H
@@ -0,0 +1,189 @@
+// 线程池工作队列的竞争测试：std::list + 互斥锁 + 信号量 对比 无锁环形队列 + eventcount
+// 用法: ./queue_bench [生产者数] [消费者数] [每个生产者的任务数]
+#include "locker.h"
+#include "mpmc_queue.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <list>
+#include <atomic>
+
+#define QUEUE_CAPACITY 10000
+
+/// @brief 原来线程池使用的工作队列
+class list_queue
+{
+private:
+    locker m_locker;
+    std::list<long> m_list;
+    sem m_stat;
+
+public:
+    bool push(long data)
+    {
+        m_locker.lock();
+        if (m_list.size() >= QUEUE_CAPACITY)
+        {
+            m_locker.unlock();
+            return false;
+        }
+        m_list.push_back(data);
+        m_locker.unlock();
+        m_stat.post();
+        return true;
+    }
+    long pop()
+    {
+        while (true)
+        {
+            m_stat.wait();
+            m_locker.lock();
+            if (m_list.empty())
+            {
+                m_locker.unlock();
+                continue;
+            }
+            long data = m_list.front();
+            m_list.pop_front();
+            m_locker.unlock();
+            return data;
+        }
+    }
+};
+
+/// @brief 现在线程池使用的工作队列
+class ring_queue
+{
+private:
+    mpmc_queue<long> m_queue;
+    event_count m_event;
+
+public:
+    ring_queue() : m_queue(QUEUE_CAPACITY) {}
+    bool push(long data)
+    {
+        if (!m_queue.push(data))
+        {
+            return false;
+        }
+        m_event.notify();
+        return true;
+    }
+    long pop()
+    {
+        long data;
+        while (true)
+        {
+            if (m_queue.pop(data))
+            {
+                return data;
+            }
+            int key = m_event.prepare_wait();
+            if (m_queue.pop(data))
+            {
+                m_event.cancel_wait();
+                return data;
+            }
+            m_event.wait(key);
+        }
+    }
+};
+
+static long item_num = 1000000;
+static std::atomic<long> checksum(0);
+
+template <typename Q>
+void *producer(void *arg)
+{
+    Q *queue = (Q *)arg;
+    for (long i = 1; i <= item_num; i++)
+    {
+        while (!queue->push(i))
+        {
+            // 队列满，让出CPU
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+template <typename Q>
+void *consumer(void *arg)
+{
+    Q *queue = (Q *)arg;
+    long sum = 0;
+    while (true)
+    {
+        long data = queue->pop();
+        // 0是结束标记
+        if (data == 0)
+        {
+            break;
+        }
+        sum += data;
+    }
+    checksum += sum;
+    return NULL;
+}
+
+template <typename Q>
+double run(const char *name, int producer_num, int consumer_num)
+{
+    Q *queue = new Q;
+    pthread_t *producers = new pthread_t[producer_num];
+    pthread_t *consumers = new pthread_t[consumer_num];
+    checksum = 0;
+
+    timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (int i = 0; i < consumer_num; i++)
+    {
+        pthread_create(consumers + i, NULL, consumer<Q>, queue);
+    }
+    for (int i = 0; i < producer_num; i++)
+    {
+        pthread_create(producers + i, NULL, producer<Q>, queue);
+    }
+    for (int i = 0; i < producer_num; i++)
+    {
+        pthread_join(producers[i], NULL);
+    }
+    for (int i = 0; i < consumer_num; i++)
+    {
+        while (!queue->push(0))
+        {
+            sched_yield();
+        }
+    }
+    for (int i = 0; i < consumer_num; i++)
+    {
+        pthread_join(consumers[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    long total = item_num * producer_num;
+    long expect = item_num * (item_num + 1) / 2 * producer_num;
+    printf("%-12s %8.3f s %12.0f ops/s %s\n", name, seconds, total / seconds, checksum == expect ? "" : "校验失败");
+
+    delete[] producers;
+    delete[] consumers;
+    delete queue;
+    return seconds;
+}
+
+int main(int argc, const char *argv[])
+{
+    int producer_num = argc > 1 ? atoi(argv[1]) : 1;
+    int consumer_num = argc > 2 ? atoi(argv[2]) : 8;
+    if (argc > 3)
+    {
+        item_num = atol(argv[3]);
+    }
+    printf("生产者 %d, 消费者 %d, 每个生产者 %ld 个任务\n", producer_num, consumer_num, item_num);
+    double list_time = run<list_queue>("list+mutex", producer_num, consumer_num);
+    double ring_time = run<ring_queue>("mpmc ring", producer_num, consumer_num);
+    printf("加速比 %.2fx\n", list_time / ring_time);
+    return 0;
+}
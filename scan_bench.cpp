@@ -0,0 +1,112 @@
+// 分隔符查找的测试：原来逐字节的parse_line循环 对比 各个向量化实现
+// 用法: ./scan_bench [cookie长度] [重复次数]
+#include "http_scan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+
+/// @brief 原来parse_line里的逐字节循环，返回第一个\r或\n的位置
+static const char *old_scan(const char *begin, const char *end)
+{
+    while (begin < end)
+    {
+        char temp = *begin;
+        if (temp == '\r' || temp == '\n')
+        {
+            return begin;
+        }
+        begin++;
+    }
+    return end;
+}
+
+static const char *old_scan_any2(const char *begin, const char *end, char, char)
+{
+    return old_scan(begin, end);
+}
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief 按行切分整个请求头，返回找到的行数
+ *
+ */
+static long split_lines(const char *(*scan)(const char *, const char *, char, char), const std::string &data, int rounds, double &seconds)
+{
+    long lines = 0;
+    double begin = now();
+    for (int r = 0; r < rounds; r++)
+    {
+        const char *p = data.data();
+        const char *end = p + data.size();
+        while (p < end)
+        {
+            p = scan(p, end, '\r', '\n');
+            if (p == end)
+            {
+                break;
+            }
+            lines++;
+            p += 2;
+        }
+    }
+    seconds = now() - begin;
+    return lines;
+}
+
+int main(int argc, const char *argv[])
+{
+    int cookie_len = argc > 1 ? atoi(argv[1]) : 4096;
+    int rounds = argc > 2 ? atoi(argv[2]) : 20000;
+
+    std::string data = "GET /index.html HTTP/1.1\r\nHost: example.com\r\nUser-Agent: Mozilla/5.0 (X11; Linux x86_64)\r\n"
+                       "Accept: text/html,application/xhtml+xml\r\nAccept-Encoding: gzip, deflate, br\r\nCookie: ";
+    for (int i = 0; i < cookie_len; i++)
+    {
+        data += (char)('a' + i % 26);
+    }
+    data += "\r\nConnection: keep-alive\r\n\r\n";
+    printf("请求头 %zu 字节, 重复 %d 次, 当前实现 %s\n", data.size(), rounds, scan_impl_name());
+
+    struct
+    {
+        const char *name;
+        const char *(*scan)(const char *, const char *, char, char);
+    } impls[] = {
+        {"byte loop", old_scan_any2},
+        {"scalar", scan_any2_scalar},
+#if defined(__x86_64__) || defined(__i386__)
+        {"sse2", scan_any2_sse2},
+        {"avx2", scan_any2_avx2},
+#endif
+        {"dispatch", scan_any2},
+    };
+    double base = 0;
+    long expect = -1;
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        if (impls[i].scan == scan_any2_avx2 && !__builtin_cpu_supports("avx2"))
+        {
+            continue;
+        }
+#endif
+        double seconds;
+        long lines = split_lines(impls[i].scan, data, rounds, seconds);
+        if (expect == -1)
+        {
+            expect = lines;
+            base = seconds;
+        }
+        printf("%-10s %8.3f s %8.2f GB/s %6.2fx %s\n", impls[i].name, seconds, data.size() * (double)rounds / seconds / 1e9,
+               base / seconds, lines == expect ? "" : "结果不一致");
+    }
+    return 0;
+}
@@ -2,67 +2,119 @@
 #define THREADPOOL_H
 
 #include "locker.h"
+#include "mpmc_queue.h"
 #include <exception>
 #include <pthread.h>
-#include <list>
+#include <sched.h>
+#include <unistd.h>
 #include <iostream>
-#include <semaphore.h>
+#include <atomic>
 
 template <typename T>
 class threadpool
 {
 public:
-    threadpool(int pool_size = 8, int request_num = 10000);
+    /**
+     * @param pool_size 线程数量，0表示按CPU核数
+     * @param request_num 请求最大数量
+     * @param work_stealing 每个线程一个本地队列，空闲时从其他线程的队列偷任务
+     * @param pin_cpu 把第i个线程绑定到第i个CPU
+     */
+    threadpool(int pool_size = 0, int request_num = 10000, bool work_stealing = false, bool pin_cpu = false);
     ~threadpool();
     // 将要处理的请求放入工作队列
     bool append(T *work_package);
 
 private:
+    /// @brief 线程参数
+    struct worker_arg
+    {
+        threadpool *m_pool;
+        int m_index;
+    };
+
     // 池的大小（线程数量）
     int m_pool_size;
     // 请求最大数量
     int m_request_num;
     // 线程数组
     pthread_t *m_threads;
-    // 工作队列锁
-    locker m_queue_locker;
-    // 工作队列
-    std::list<T *> m_work_queue;
-    // 判断队列是否有工作需要处理
-    sem m_queue_stat;
+    worker_arg *m_worker_args;
+    // 工作队列，无锁环形队列，入队不分配内存
+    mpmc_queue<T *> m_work_queue;
+    // 工作窃取模式下每个线程的本地队列
+    mpmc_queue<T *> **m_local_queues;
+    int m_queue_num;
+    // 下一个放入任务的本地队列
+    std::atomic<unsigned> m_next_queue;
+    // 空闲线程在这里睡眠，没有线程睡眠时唤醒不进入内核
+    event_count m_queue_event;
     // 线程是否继续工作
-    bool m_is_stop;
+    std::atomic<bool> m_is_stop;
+    bool m_work_stealing;
+    bool m_pin_cpu;
 
 private:
     // 线程工作函数
     static void *worker(void *arg);
-    void run();
+    void run(int index);
+    bool take(int index, T *&request);
+    void stop_threads();
 };
 
 template <typename T>
-threadpool<T>::threadpool(int pool_size, int request_num) : m_pool_size(pool_size), m_request_num(request_num), m_threads(NULL), m_is_stop(false)
+threadpool<T>::threadpool(int pool_size, int request_num, bool work_stealing, bool pin_cpu)
+    : m_pool_size(pool_size), m_request_num(request_num), m_threads(NULL), m_worker_args(NULL),
+      m_work_queue(work_stealing || request_num <= 0 ? 1 : request_num), m_local_queues(NULL), m_queue_num(0), m_next_queue(0),
+      m_is_stop(false), m_work_stealing(work_stealing), m_pin_cpu(pin_cpu)
 {
-    if (pool_size <= 0 || request_num <= 0)
+    if (pool_size < 0 || request_num <= 0)
     {
         throw std::exception();
     }
-    // 初始化线程
-    m_threads = new pthread_t[pool_size];
-    if (m_threads == NULL)
+    int cpu_num = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpu_num <= 0)
     {
-        throw std::exception();
+        cpu_num = 1;
+    }
+    if (m_pool_size == 0)
+    {
+        m_pool_size = cpu_num;
     }
 
-    pthread_attr_t threads_attr;
-    pthread_attr_init(&threads_attr);
-    pthread_attr_setdetachstate(&threads_attr, PTHREAD_CREATE_DETACHED);
-    for (int i = 0; i < pool_size; i++)
+    if (m_work_stealing)
+    {
+        // 总容量和共享队列一样
+        m_queue_num = m_pool_size;
+        m_local_queues = new mpmc_queue<T *> *[m_queue_num];
+        for (int i = 0; i < m_queue_num; i++)
+        {
+            m_local_queues[i] = new mpmc_queue<T *>(request_num / m_queue_num + 1);
+        }
+    }
+
+    // 初始化线程
+    m_threads = new pthread_t[m_pool_size];
+    m_worker_args = new worker_arg[m_pool_size];
+    int thread_num = m_pool_size;
+    for (int i = 0; i < thread_num; i++)
     {
-        if (pthread_create(m_threads + i, &threads_attr, worker, this) != 0)
+        m_worker_args[i].m_pool = this;
+        m_worker_args[i].m_index = i;
+        if (pthread_create(m_threads + i, NULL, worker, m_worker_args + i) != 0)
         {
-            delete[] m_threads;
+            // 停掉已经创建的线程
+            m_pool_size = i;
+            stop_threads();
             throw std::exception();
         }
+        if (m_pin_cpu)
+        {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(i % cpu_num, &cpus);
+            pthread_setaffinity_np(m_threads[i], sizeof(cpus), &cpus);
+        }
         printf("thread %i is ready\n", i);
     }
 }
@@ -70,57 +122,122 @@ threadpool<T>::threadpool(int pool_size, int request_num) : m_pool_size(pool_siz
 template <typename T>
 threadpool<T>::~threadpool()
 {
-    delete[] m_threads;
-    m_is_stop = true;
+    stop_threads();
+}
+
+/**
+ * @brief 通知所有线程退出并等待
+ *
+ */
+template <typename T>
+void threadpool<T>::stop_threads()
+{
+    if (m_threads != NULL)
+    {
+        m_is_stop = true;
+        m_queue_event.notify_all();
+        for (int i = 0; i < m_pool_size; i++)
+        {
+            pthread_join(m_threads[i], NULL);
+        }
+        delete[] m_threads;
+        m_threads = NULL;
+    }
+    delete[] m_worker_args;
+    m_worker_args = NULL;
+    if (m_local_queues != NULL)
+    {
+        for (int i = 0; i < m_queue_num; i++)
+        {
+            delete m_local_queues[i];
+        }
+        delete[] m_local_queues;
+        m_local_queues = NULL;
+    }
 }
 
 template <typename T>
 bool threadpool<T>::append(T *work_package)
 {
-    printf("enter append\n");
-    if (m_work_queue.size() >= m_request_num)
+    bool ok = false;
+    if (m_work_stealing)
+    {
+        // 轮流放入各线程的本地队列，满了就换下一个
+        unsigned start = m_next_queue.fetch_add(1, std::memory_order_relaxed);
+        for (int i = 0; i < m_queue_num && !ok; i++)
+        {
+            ok = m_local_queues[(start + i) % m_queue_num]->push(work_package);
+        }
+    }
+    else
+    {
+        ok = m_work_queue.push(work_package);
+    }
+    if (!ok)
     {
         std::cout << "work queue is full\n";
         return false;
     }
-    m_queue_locker.lock();
-    m_work_queue.push_back(work_package);
-    m_queue_locker.unlock();
-    m_queue_stat.post();
-    printf("exit append\n");
-
+    m_queue_event.notify();
     return true;
 }
 template <typename T>
 void *threadpool<T>::worker(void *arg)
 {
-    // arg是一个线程池指针
-    threadpool *pool = (threadpool *)arg;
-    if (pool == NULL)
+    worker_arg *warg = (worker_arg *)arg;
+    if (warg == NULL || warg->m_pool == NULL)
     {
         throw std::exception();
     }
 
-    pool->run();
-    return pool;
+    warg->m_pool->run(warg->m_index);
+    return warg->m_pool;
 }
+
+/**
+ * @brief 取一个任务。工作窃取模式下先取自己的队列，再依次从其他线程的队列偷
+ *
+ * @param index 线程编号
+ * @param request
+ * @return true 取到任务
+ */
 template <typename T>
-void threadpool<T>::run()
+bool threadpool<T>::take(int index, T *&request)
 {
-    while (!m_is_stop)
+    if (!m_work_stealing)
     {
-        m_queue_stat.wait();
-        m_queue_locker.lock();
-        if (m_work_queue.empty())
+        return m_work_queue.pop(request);
+    }
+    for (int i = 0; i < m_queue_num; i++)
+    {
+        if (m_local_queues[(index + i) % m_queue_num]->pop(request))
         {
-            m_queue_stat.post();
-            m_queue_locker.unlock();
-            continue;
+            return true;
         }
+    }
+    return false;
+}
 
-        T *request = m_work_queue.front();
-        m_work_queue.pop_front();
-        m_queue_locker.unlock();
+template <typename T>
+void threadpool<T>::run(int index)
+{
+    while (!m_is_stop)
+    {
+        T *request = NULL;
+        if (!take(index, request))
+        {
+            // 先登记为等待者再检查一次，避免错过append的notify
+            int key = m_queue_event.prepare_wait();
+            if (m_is_stop || take(index, request))
+            {
+                m_queue_event.cancel_wait();
+            }
+            else
+            {
+                m_queue_event.wait(key);
+                continue;
+            }
+        }
         if (request == NULL)
         {
             continue;
@@ -131,4 +248,4 @@ void threadpool<T>::run()
     }
 }
 
-#endif
\ No newline at end of file
+#endif
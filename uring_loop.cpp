@@ -0,0 +1,660 @@
+#include "uring_loop.h"
+#include "http_response.h"
+#include "prefetcher.h"
+#include <sys/syscall.h>
+#include <sys/socket.h>
+
+/// @brief user_data的高8位是请求类型，其余是连接句柄或fd
+static inline __u64 encode_data(URING_OP op, __u64 value)
+{
+    return ((__u64)op << 56) | (value & (((__u64)1 << 56) - 1));
+}
+
+uring_loop::uring_loop(int port) : m_port(port), m_listen_fd(-1), m_wakeup_fd(-1), m_wakeup_value(0), m_ring_fd(-1),
+                                   m_sq_ptr(MAP_FAILED), m_sq_size(0), m_cq_ptr(MAP_FAILED), m_cq_size(0), m_sqes((struct io_uring_sqe *)MAP_FAILED), m_sqes_size(0),
+                                   m_sq_entries(0), m_sq_local_tail(0), m_to_submit(0),
+                                   m_buf_ring((struct io_uring_buf_ring *)MAP_FAILED), m_bufs(NULL), m_busy_num(0), m_nobufs_num(0),
+                                   m_is_started(false), m_is_stop(false)
+{
+    m_tick.tv_sec = TIMER_SLOT;
+    m_tick.tv_nsec = 0;
+}
+
+uring_loop::~uring_loop()
+{
+    if (m_buf_ring != MAP_FAILED)
+    {
+        munmap(m_buf_ring, URING_BUF_NUM * sizeof(struct io_uring_buf));
+    }
+    if (m_sqes != MAP_FAILED)
+    {
+        munmap(m_sqes, m_sqes_size);
+    }
+    if (m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr)
+    {
+        munmap(m_cq_ptr, m_cq_size);
+    }
+    if (m_sq_ptr != MAP_FAILED)
+    {
+        munmap(m_sq_ptr, m_sq_size);
+    }
+    if (m_ring_fd != -1)
+    {
+        close(m_ring_fd);
+    }
+    if (m_wakeup_fd != -1)
+    {
+        close(m_wakeup_fd);
+    }
+    if (m_listen_fd != -1)
+    {
+        close(m_listen_fd);
+    }
+    delete[] m_bufs;
+}
+
+/**
+ * @brief 创建监听socket、io_uring并注册接收缓冲区
+ *
+ * @return true 成功
+ * @return false 失败(内核不支持时调用者应回退到epoll)
+ */
+bool uring_loop::init()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_COOP_TASKRUN;
+    m_ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (m_ring_fd < 0 && errno == EINVAL)
+    {
+        // 老内核不认识COOP_TASKRUN
+        params.flags = 0;
+        m_ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    }
+    if (m_ring_fd < 0)
+    {
+        perror("io_uring_setup");
+        return false;
+    }
+    if (!(params.features & IORING_FEAT_FAST_POLL))
+    {
+        printf("io_uring: 内核不支持FAST_POLL\n");
+        return false;
+    }
+
+    // 映射提交队列和完成队列
+    m_sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+    {
+        m_sq_size = m_cq_size = std::max(m_sq_size, m_cq_size);
+    }
+    m_sq_ptr = mmap(NULL, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+    if (m_sq_ptr == MAP_FAILED)
+    {
+        perror("mmap sq");
+        return false;
+    }
+    if (single_mmap)
+    {
+        m_cq_ptr = m_sq_ptr;
+    }
+    else
+    {
+        m_cq_ptr = mmap(NULL, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING);
+        if (m_cq_ptr == MAP_FAILED)
+        {
+            perror("mmap cq");
+            return false;
+        }
+    }
+    m_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    m_sqes = (struct io_uring_sqe *)mmap(NULL, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED)
+    {
+        perror("mmap sqes");
+        return false;
+    }
+    char *sq = (char *)m_sq_ptr;
+    char *cq = (char *)m_cq_ptr;
+    m_sq_head = (unsigned *)(sq + params.sq_off.head);
+    m_sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    m_sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    m_sq_array = (unsigned *)(sq + params.sq_off.array);
+    m_sq_entries = params.sq_entries;
+    m_sq_local_tail = *m_sq_tail;
+    m_cq_head = (unsigned *)(cq + params.cq_off.head);
+    m_cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    m_cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    m_cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // 注册接收缓冲区环，内核收到数据时自己挑一个缓冲区
+    m_buf_ring = (struct io_uring_buf_ring *)mmap(NULL, URING_BUF_NUM * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m_buf_ring == MAP_FAILED)
+    {
+        perror("mmap buf ring");
+        return false;
+    }
+    // 注册前先写一遍，让内核固定的是已经分配好的页，而不是共享的零页
+    memset(m_buf_ring, 0, URING_BUF_NUM * sizeof(struct io_uring_buf));
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (__u64)m_buf_ring;
+    reg.ring_entries = URING_BUF_NUM;
+    reg.bgid = URING_BUF_GROUP;
+    if (syscall(__NR_io_uring_register, m_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        perror("io_uring_register pbuf ring");
+        return false;
+    }
+    m_bufs = new char[URING_BUF_NUM * URING_BUF_SIZE];
+    m_buf_ring->tail = 0;
+    for (int i = 0; i < URING_BUF_NUM; i++)
+    {
+        recycle_buffer(i);
+    }
+
+
+    // 申请用于监听的文件描述符
+    m_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (m_listen_fd == -1)
+    {
+        perror("socket");
+        return false;
+    }
+    // 设置端口复用
+    int opt = 1;
+    setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+    sockaddr_in server_addr;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(m_port);
+    if (bind(m_listen_fd, (sockaddr *)&server_addr, sizeof(server_addr)) == -1)
+    {
+        perror("bind");
+        return false;
+    }
+    if (listen(m_listen_fd, 1024) == -1)
+    {
+        perror("listen");
+        return false;
+    }
+
+    m_wakeup_fd = eventfd(0, EFD_NONBLOCK);
+    if (m_wakeup_fd == -1)
+    {
+        perror("eventfd");
+        return false;
+    }
+    printf("listen_fd = %d, ring_fd = %d\n", m_listen_fd, m_ring_fd);
+    return true;
+}
+
+bool uring_loop::start()
+{
+    if (pthread_create(&m_thread, NULL, worker, this) != 0)
+    {
+        return false;
+    }
+    m_is_started = true;
+    return true;
+}
+
+void *uring_loop::worker(void *arg)
+{
+    uring_loop *loop = (uring_loop *)arg;
+    loop->run();
+    return loop;
+}
+
+void uring_loop::stop()
+{
+    m_is_stop = true;
+    eventfd_write(m_wakeup_fd, 1);
+}
+
+void uring_loop::join()
+{
+    if (m_is_started)
+    {
+        pthread_join(m_thread, NULL);
+        m_is_started = false;
+    }
+}
+
+/**
+ * @brief 取一个空闲的提交队列项，队列满时先提交
+ *
+ * @return struct io_uring_sqe*
+ */
+struct io_uring_sqe *uring_loop::get_sqe()
+{
+    unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    if (m_sq_local_tail - head >= m_sq_entries)
+    {
+        submit_and_wait(0);
+        head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    }
+    unsigned index = m_sq_local_tail & *m_sq_mask;
+    struct io_uring_sqe *sqe = &m_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    m_sq_array[index] = index;
+    m_sq_local_tail++;
+    m_to_submit++;
+    return sqe;
+}
+
+/**
+ * @brief 提交所有准备好的请求，并等待至少wait_num个完成事件
+ *
+ * @param wait_num
+ * @return int io_uring_enter的返回值
+ */
+int uring_loop::submit_and_wait(unsigned wait_num)
+{
+    __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+    unsigned flags = wait_num > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int ret = syscall(__NR_io_uring_enter, m_ring_fd, m_to_submit, wait_num, flags, NULL, 0);
+    if (ret > 0)
+    {
+        m_to_submit -= std::min((unsigned)ret, m_to_submit);
+    }
+    return ret;
+}
+
+/**
+ * @brief 把接收缓冲区还给内核
+ *
+ * @param bid 缓冲区编号
+ */
+void uring_loop::recycle_buffer(int bid)
+{
+    unsigned short tail = m_buf_ring->tail;
+    // C++下头文件里柔性数组前的空结构体占1字节，bufs的偏移不对，直接按数组计算
+    struct io_uring_buf *buf = (struct io_uring_buf *)m_buf_ring + (tail & (URING_BUF_NUM - 1));
+    buf->addr = (__u64)(m_bufs + (size_t)bid * URING_BUF_SIZE);
+    buf->len = URING_BUF_SIZE;
+    buf->bid = bid;
+    __atomic_store_n(&m_buf_ring->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+void uring_loop::arm_accept()
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = encode_data(URING_ACCEPT, m_listen_fd);
+}
+
+void uring_loop::arm_recv(http_conn *conn)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->get_sockfd();
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = encode_data(URING_RECV, conn->get_handle());
+    get_state(conn).recv_armed = true;
+}
+
+void uring_loop::arm_timeout()
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (__u64)&m_tick;
+    sqe->len = 1;
+    sqe->user_data = encode_data(URING_TIMEOUT, 0);
+}
+
+void uring_loop::arm_wakeup()
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = m_wakeup_fd;
+    sqe->addr = (__u64)&m_wakeup_value;
+    sqe->len = sizeof(m_wakeup_value);
+    sqe->user_data = encode_data(URING_WAKEUP, m_wakeup_fd);
+}
+
+void uring_loop::run()
+{
+    arm_accept();
+    arm_timeout();
+    arm_wakeup();
+    while (!m_is_stop)
+    {
+        int ret = submit_and_wait(1);
+        if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            perror("io_uring_enter");
+            break;
+        }
+        http_date::update();
+
+        unsigned head = *m_cq_head;
+        unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail)
+        {
+            struct io_uring_cqe *cqe = &m_cqes[head & *m_cq_mask];
+            __u64 data = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            head++;
+            // 先归还完成队列项，处理过程中提交的请求不会把完成队列挤满
+            __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+
+            URING_OP op = (URING_OP)(data >> 56);
+            // 连接的IO请求全部完成后才释放槽位，这里的句柄总是有效的
+            http_conn *conn = (op == URING_RECV || op == URING_SEND || op == URING_PREFETCH)
+                                  ? conns->get(data & (((__u64)1 << 56) - 1))
+                                  : NULL;
+            switch (op)
+            {
+            case URING_ACCEPT:
+                deal_accept(res, flags);
+                break;
+            case URING_RECV:
+                if (conn != NULL)
+                {
+                    deal_recv(conn, res, flags);
+                }
+                break;
+            case URING_SEND:
+                if (conn != NULL)
+                {
+                    deal_send(conn, res);
+                }
+                break;
+            case URING_TIMEOUT:
+                m_timer_list.address_expired();
+                arm_timeout();
+                break;
+            case URING_WAKEUP:
+                arm_wakeup();
+                break;
+            case URING_PREFETCH:
+                // 预读失败不影响后面的send，只是send自己等磁盘
+                if (conn != NULL)
+                {
+                    deal_send(conn, 0);
+                }
+                break;
+            }
+            tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+        }
+    }
+    // 过载只计数，退出时打印一次，不在每次发生时写stdout
+    if (m_busy_num > 0 || m_nobufs_num > 0)
+    {
+        printf("io_uring: 连接表满%ld次, 接收缓冲区不足%ld次\n", m_busy_num, m_nobufs_num);
+    }
+}
+
+void uring_loop::deal_accept(int res, unsigned flags)
+{
+    if (!(flags & IORING_CQE_F_MORE))
+    {
+        // multishot accept结束了，需要重新提交
+        if (res == -EINVAL)
+        {
+            printf("io_uring: 内核不支持multishot accept\n");
+            m_is_stop = true;
+            return;
+        }
+        arm_accept();
+    }
+    if (res < 0)
+    {
+        return;
+    }
+    int sockfd = res;
+    conn_handle handle;
+    http_conn *conn = conns->alloc(handle);
+    if (conn == NULL)
+    {
+        // 服务器正忙
+        m_busy_num++;
+        close(sockfd);
+        return;
+    }
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    conn->init(sockfd, addr, -1, handle);
+    conn_timer *timer = new conn_timer(conn);
+    m_timer_list.append(timer);
+    conn->set_timer(timer);
+
+    if (conn_handle_slot(handle) >= m_states.size())
+    {
+        m_states.resize(conns->capacity());
+    }
+    memset(&get_state(conn), 0, sizeof(uring_conn_state));
+    arm_recv(conn);
+}
+
+void uring_loop::deal_recv(http_conn *conn, int res, unsigned flags)
+{
+    uring_conn_state &state = get_state(conn);
+    if (!(flags & IORING_CQE_F_MORE))
+    {
+        state.recv_armed = false;
+    }
+
+    if (res > 0)
+    {
+        int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        bool ok = conn->append_read(m_bufs + (size_t)bid * URING_BUF_SIZE, res);
+        recycle_buffer(bid);
+        if (!ok)
+        {
+            // 请求太大
+            state.closing = true;
+            conn->close_conn();
+        }
+        else if (!state.closing && state.inflight_sends == 0)
+        {
+            process_conn(conn);
+            m_timer_list.adjust_timer(conn->get_timer());
+        }
+    }
+    else if (res == -ENOBUFS && !state.closing)
+    {
+        // 缓冲区暂时用完，下面重新提交recv
+        m_nobufs_num++;
+    }
+    else if (!state.closing)
+    {
+        // 对方关闭连接或出错
+        state.closing = true;
+        conn->close_conn();
+    }
+
+    if (state.closing)
+    {
+        try_release(conn);
+    }
+    else if (!state.recv_armed)
+    {
+        arm_recv(conn);
+    }
+}
+
+/**
+ * @brief 解析已经收到的请求，流水线中的多个请求的响应一起提交
+ *
+ * @param conn
+ */
+void uring_loop::process_conn(http_conn *conn)
+{
+    uring_conn_state &state = get_state(conn);
+    if (!conn->process_requests())
+    {
+        state.closing = true;
+        conn->close_conn();
+        return;
+    }
+    int count = 0;
+    conn->get_iov(count);
+    if (count > 0)
+    {
+        submit_response(conn);
+    }
+}
+
+/**
+ * @brief 提交响应，每段数据一个send，用IOSQE_IO_LINK串起来保证顺序
+ *
+ * @param conn
+ */
+void uring_loop::submit_response(http_conn *conn)
+{
+    uring_conn_state &state = get_state(conn);
+    int count = 0;
+    const struct iovec *iv = conn->get_iov(count);
+    state.sent = 0;
+    state.total = 0;
+    for (int i = 0; i < count; i++)
+    {
+        state.total += iv[i].iov_len;
+    }
+    send_remaining(conn);
+}
+
+/**
+ * @brief 发送响应中还没有发出去的部分。短写会打断链接，剩下的send被取消，之后从这里接着发。
+ * 文件映射中不在页缓存里的数据，send前面先链接一个MADV_POPULATE_READ，由内核的io-wq线程等磁盘，
+ * 本循环线程不会在send里缺页
+ *
+ * @param conn
+ */
+void uring_loop::send_remaining(http_conn *conn)
+{
+    uring_conn_state &state = get_state(conn);
+    int count = 0;
+    const struct iovec *iv = conn->get_iov(count);
+    size_t skip = state.sent;
+    struct io_uring_sqe *last = NULL;
+    for (int i = 0; i < count; i++)
+    {
+        if (skip >= iv[i].iov_len)
+        {
+            skip -= iv[i].iov_len;
+            continue;
+        }
+        const char *data = (const char *)iv[i].iov_base + skip;
+        size_t len = iv[i].iov_len - skip;
+        if (http_conn::m_prefetcher != NULL && conn->iov_mapped(i) && !http_conn::m_prefetcher->resident(data, len))
+        {
+            // madvise的地址要按页对齐
+            static const size_t page_size = sysconf(_SC_PAGESIZE);
+            __u64 start = (__u64)data & ~(__u64)(page_size - 1);
+            struct io_uring_sqe *sqe = get_sqe();
+            sqe->opcode = IORING_OP_MADVISE;
+            sqe->fd = -1;
+            sqe->addr = start;
+            sqe->len = std::min((__u64)data + len - start, (__u64)UINT32_MAX);
+            sqe->fadvise_advice = MADV_POPULATE_READ;
+            // 预读失败时后面的send照常执行
+            sqe->flags = IOSQE_IO_HARDLINK;
+            sqe->user_data = encode_data(URING_PREFETCH, conn->get_handle());
+            state.inflight_sends++;
+        }
+        struct io_uring_sqe *sqe = get_sqe();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = conn->get_sockfd();
+        sqe->addr = (__u64)data;
+        sqe->len = len;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = encode_data(URING_SEND, conn->get_handle());
+        state.inflight_sends++;
+        skip = 0;
+        last = sqe;
+    }
+    if (last != NULL)
+    {
+        last->flags &= ~IOSQE_IO_LINK;
+    }
+}
+
+void uring_loop::deal_send(http_conn *conn, int res)
+{
+    uring_conn_state &state = get_state(conn);
+    state.inflight_sends--;
+    if (res > 0)
+    {
+        state.sent += res;
+    }
+    else if (res < 0 && res != -ECANCELED && !state.closing)
+    {
+        state.closing = true;
+        conn->close_conn();
+    }
+    if (state.inflight_sends > 0)
+    {
+        return;
+    }
+
+    if (state.closing)
+    {
+        try_release(conn);
+    }
+    else if (state.sent < state.total)
+    {
+        send_remaining(conn);
+    }
+    else if (conn->next_chunk())
+    {
+        // 流式响应的下一块
+        submit_response(conn);
+    }
+    else if (conn->finish_write())
+    {
+        m_timer_list.adjust_timer(conn->get_timer());
+        // 发送期间收到的流水线请求
+        if (conn->has_pending_input())
+        {
+            process_conn(conn);
+            if (state.closing)
+            {
+                try_release(conn);
+            }
+        }
+    }
+    else
+    {
+        state.closing = true;
+        conn->close_conn();
+        try_release(conn);
+    }
+}
+
+/**
+ * @brief 连接上没有未完成的请求时才真正关闭，保证迟到的完成事件不会落到复用的fd和槽位上
+ *
+ * @param conn
+ */
+void uring_loop::try_release(http_conn *conn)
+{
+    uring_conn_state &state = get_state(conn);
+    if (state.recv_armed || state.inflight_sends > 0)
+    {
+        return;
+    }
+    int fd = conn->get_sockfd();
+    conn->unmap();
+    conn->free_buffer();
+    conn->reset_arena();
+    m_timer_list.del_timer(conn->get_timer());
+    conn->set_timer(NULL);
+    memset(&state, 0, sizeof(state));
+    close(fd);
+    http_conn::m_user_num--;
+    conns->free(conn);
+}
@@ -0,0 +1,126 @@
+#ifndef URING_LOOP_H
+#define URING_LOOP_H
+
+#include "http_conn.h"
+#include "conn_timer.h"
+#include "event_loop.h"
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <vector>
+
+// 提交队列长度
+#define URING_ENTRIES 4096
+// 提供给内核的接收缓冲区个数(2的幂)和大小
+#define URING_BUF_NUM 1024
+#define URING_BUF_SIZE READ_BUFFER_SIZE
+#define URING_BUF_GROUP 0
+
+/// @brief io_uring请求类型，和连接句柄或fd一起编码在user_data里
+enum URING_OP
+{
+    URING_ACCEPT = 1,
+    URING_RECV,
+    URING_SEND,
+    URING_TIMEOUT,
+    URING_WAKEUP,
+    URING_PREFETCH,
+};
+
+/// @brief io_uring后端下每个连接的IO状态
+struct uring_conn_state
+{
+    // multishot recv是否还在内核中
+    bool recv_armed;
+    // 已提交、尚未完成的send数量(包括send前面的预读)
+    int inflight_sends;
+    // 当前响应已发送的字节数
+    size_t sent;
+    // 当前响应的总字节数
+    size_t total;
+    // 连接是否等待关闭
+    bool closing;
+};
+
+/**
+ * @brief io_uring事件循环
+ * 用multishot accept、提供缓冲区的multishot recv和链接的send，一次io_uring_enter
+ * 处理多个连接的IO。请求在本循环线程中直接处理。
+ */
+class uring_loop
+{
+public:
+    uring_loop(int port);
+    ~uring_loop();
+    // 创建监听socket、io_uring和接收缓冲区，内核不支持时返回false
+    bool init();
+    bool start();
+    void run();
+    void stop();
+    void join();
+
+private:
+    int m_port;
+    int m_listen_fd;
+    int m_wakeup_fd;
+    eventfd_t m_wakeup_value;
+
+    // io_uring
+    int m_ring_fd;
+    void *m_sq_ptr;
+    size_t m_sq_size;
+    void *m_cq_ptr;
+    size_t m_cq_size;
+    struct io_uring_sqe *m_sqes;
+    size_t m_sqes_size;
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned *m_sq_mask;
+    unsigned *m_sq_array;
+    unsigned m_sq_entries;
+    // 本地的提交队列尾，io_uring_enter前才发布给内核
+    unsigned m_sq_local_tail;
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned *m_cq_mask;
+    struct io_uring_cqe *m_cqes;
+    // 已放入提交队列、还没有io_uring_enter的请求数
+    unsigned m_to_submit;
+
+    // 提供给内核的接收缓冲区
+    struct io_uring_buf_ring *m_buf_ring;
+    char *m_bufs;
+    // 连接表满拒绝的连接数和接收缓冲区用完的次数
+    long m_busy_num;
+    long m_nobufs_num;
+
+    // 各连接的IO状态，按连接表的槽位号索引，随槽位数增长
+    std::vector<uring_conn_state> m_states;
+    conn_timer_list m_timer_list;
+    struct __kernel_timespec m_tick;
+    pthread_t m_thread;
+    bool m_is_started;
+    volatile bool m_is_stop;
+
+private:
+    static void *worker(void *arg);
+    struct io_uring_sqe *get_sqe();
+    int submit_and_wait(unsigned wait_num);
+    void recycle_buffer(int bid);
+
+    void arm_accept();
+    void arm_recv(http_conn *conn);
+    void arm_timeout();
+    void arm_wakeup();
+    void process_conn(http_conn *conn);
+    void submit_response(http_conn *conn);
+    void send_remaining(http_conn *conn);
+
+    void deal_accept(int res, unsigned flags);
+    void deal_recv(http_conn *conn, int res, unsigned flags);
+    void deal_send(http_conn *conn, int res);
+    void try_release(http_conn *conn);
+    uring_conn_state &get_state(http_conn *conn) { return m_states[conn_handle_slot(conn->get_handle())]; }
+};
+
+#endif // !URING_LOOP_H